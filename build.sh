@@ -2,17 +2,94 @@
 
 CC=gcc
 CFLAGS="-Wall -Werror -Wpedantic -Wextra -Wunused-variable -Wuninitialized -Wshadow -Wformat -Wconversion -Wfloat-equal -Wcast-qual -Wcast-align -Wstrict-aliasing -Wswitch-default -Werror=return-type -Werror=uninitialized -Werror=sign-compare -Wunused-function -Werror=aggressive-loop-optimizations -Werror=array-bounds -Ofast -funroll-loops -finline-functions -march=native -fpeel-loops "
-LIBS="-lm -lX11 -fopenmp"
+LIBS="-lm -lX11 -lXext -fopenmp"
 SRC="main.c"
 OUT="main"
 
+# ./build.sh check runs these instead of the program. a run resumed from a checkpoint has to carry on bit for bit,
+# the broad phase has to find the overlaps the all-pairs loop finds, and playing a recording back has to draw the
+# frames the live run drew. ffmpeg is stood in for by cat, so the videos compared are the raw frames.
+SCENE="--seed 7 --width 320 --height 240 --balls 400 --size 8 --no-show --checkpoint 0"
+
+check() {
+    local name=$1
+    shift
+
+    if "$@" > "$DIR/log" 2>&1; then
+        echo "ok    $name"
+    else
+        echo "FAIL  $name"
+        cat "$DIR/log"
+        FAILED=1
+    fi
+}
+
+# the frames of a trajectory resumed part way have to be the last frames of the whole one.
+same_last_frames() {
+    local first bytes
+    first=$(od -An -t u8 -j 88 -N 8 "$2")
+    bytes=$(( $(stat -c %s "$2") - first ))
+    cmp <(tail -c $bytes "$1") <(tail -c $bytes "$2")
+}
+
+resume_matches() {
+    ./$OUT $SCENE "$@" --no-render --seconds 4 --checkpoint 2 --ckpt-file "$DIR/c" --record "$DIR/whole.traj" &&
+    ./$OUT --resume "$DIR/c.000000120.ckpt" --no-render --no-show --seconds 4 --checkpoint 0 --record "$DIR/resumed.traj" &&
+    same_last_frames "$DIR/whole.traj" "$DIR/resumed.traj"
+}
+
+resume_on_threads() {
+    OMP_NUM_THREADS=$1 resume_matches
+}
+
+play_matches() {
+    ./$OUT $SCENE "$@" --seconds 2 --output "$DIR/live.raw" &&
+    ./$OUT $SCENE "$@" --seconds 2 --no-render --record "$DIR/recorded.traj" &&
+    ./$OUT --play "$DIR/recorded.traj" --width 320 --height 240 "$@" --output "$DIR/played.raw" &&
+    cmp "$DIR/live.raw" "$DIR/played.raw"
+}
+
+run_checks() {
+    DIR=$(mktemp -d)
+    FAILED=0
+    printf '#!/bin/bash\nfor last; do :; done\ncat > "$last"\n' > "$DIR/ffmpeg"
+    chmod +x "$DIR/ffmpeg"
+    export PATH="$DIR:$PATH"
+
+    check "resume, grid" resume_matches
+    check "resume, skin" resume_matches --skin 6
+    check "resume, mixed sizes" resume_matches --balls 100 --size-max 16
+    check "resume, events" resume_matches --events
+    check "resume, 3 threads" resume_on_threads 3
+
+    echo "Compiling $SRC with VERIFY_BROAD_PHASE..."
+    if $CC $CFLAGS -DVERIFY_BROAD_PHASE -o "$DIR/verify" $SRC $LIBS; then
+        check "broad phase, grid" "$DIR/verify" $SCENE --no-render --seconds 2
+        check "broad phase, skin" "$DIR/verify" $SCENE --no-render --seconds 2 --skin 6
+        check "broad phase, mixed sizes" "$DIR/verify" $SCENE --no-render --seconds 2 --balls 100 --size-max 16
+        check "broad phase, crowded" "$DIR/verify" $SCENE --no-render --seconds 2 --balls 3000 --size 4
+    else
+        echo "FAIL  broad phase build"
+        FAILED=1
+    fi
+
+    check "record and play" play_matches
+    check "record and play, panned" play_matches --world-width 480 --world-height 360 --zoom 1 --camera-x 40 --pan-x 50 --pan-y -30
+
+    rm -rf "$DIR"
+    return $FAILED
+}
+
 echo "Compiling $SRC..."
 $CC $CFLAGS -o $OUT $SRC $LIBS
 
 if [ $? -eq 0 ]; then
     echo "Build successful."
-    ./$OUT
+    if [ "$1" == "check" ]; then
+        run_checks
+    else
+        ./$OUT
+    fi
 else
     echo "Build failed."
 fi
-
@@ -0,0 +1,251 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+checkpoint files: everything needed to carry on a run from some frame and draw the same frames as if it
+had never stopped. the file is a CheckpointHeader followed by the ball arrays at the offsets it gives, and for an
+event driven run the state of the engine, which the caller lays out.
+the caller fills the writer's buffer on the frame loop, which is only a memcpy, and a background thread
+checksums it and writes it out. a new checkpoint while the last one is still being written is refused.
+reading maps the file and checks it before anything is taken out of it.
+*/
+
+
+
+
+#define CHECKPOINT_MAGIC "BALLCKPT"
+#define CHECKPOINT_VERSION 4
+#define CHECKPOINT_ALIGN 64
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t file_bytes;
+    uint64_t checksum; // of everything after the header
+
+    uint64_t frame; // the next frame to simulate
+    int32_t frame_width, frame_height;
+    int32_t world_width, world_height;
+    int32_t num_balls, ball_size, fps, seed;
+    int32_t ball_size_max, padding; // 0 for balls of one size
+
+    // how the run was drawn and stepped, so a resumed run draws the frames the first one would have.
+    int32_t camera_x, camera_y;
+    float camera_zoom, pan_x, pan_y;
+    int32_t neighbour_skin, yuv420, padding2;
+
+    // file offsets of the arrays, num_balls entries each. ball_size is the smallest of the sizes.
+    uint64_t x, y, vx, vy, color, size;
+
+    // file offset and size of the event engine's state, both 0 for a time stepped run.
+    uint64_t events, event_bytes;
+} CheckpointHeader;
+
+typedef struct
+{
+    uint8_t *buffer; // file_bytes of the checkpoint being written, CHECKPOINT_ALIGN aligned
+    char path[512];
+    pthread_t thread;
+    _Atomic bool busy;
+    bool started;
+    uint64_t written, refused, failed;
+} CheckpointWriter;
+
+
+
+
+static inline uint64_t checkpoint_align(const uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+// fills in everything about the layout of a checkpoint of num_balls balls, with room for event_bytes of engine state.
+static inline void checkpoint_layout(CheckpointHeader *header, const int num_balls, const uint64_t event_bytes)
+{
+    const uint64_t array_bytes = checkpoint_align((uint64_t)num_balls * 4);
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->header_bytes = sizeof(CheckpointHeader);
+    header->num_balls = num_balls;
+
+    header->x = checkpoint_align(sizeof(CheckpointHeader));
+    header->y = header->x + array_bytes;
+    header->vx = header->y + array_bytes;
+    header->vy = header->vx + array_bytes;
+    header->color = header->vy + array_bytes;
+    header->size = header->color + array_bytes;
+    header->events = event_bytes ? header->size + array_bytes : 0;
+    header->event_bytes = event_bytes;
+    header->file_bytes = header->size + array_bytes + checkpoint_align(event_bytes);
+}
+
+// fnv-1a over 8 bytes at a time. catches a truncated or damaged file, it isn't meant to stop anyone on purpose.
+static inline uint64_t checkpoint_checksum(const uint8_t *bytes, const uint64_t count)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (uint64_t k = 0; k + 8 <= count; k += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + k, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static inline void *checkpoint_write_thread(void *arg)
+{
+    CheckpointWriter *writer = arg;
+    CheckpointHeader *header = (CheckpointHeader *)(void *)writer->buffer;
+
+    header->checksum = checkpoint_checksum(writer->buffer + sizeof(CheckpointHeader), header->file_bytes - sizeof(CheckpointHeader));
+
+    // written next to the real name and renamed over it, so a crash never leaves half a checkpoint behind.
+    char temp_path[sizeof(writer->path) + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", writer->path);
+
+    bool ok = false;
+    const int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd >= 0)
+    {
+        uint64_t done = 0;
+        while (done < header->file_bytes)
+        {
+            const ssize_t wrote = write(fd, writer->buffer + done, header->file_bytes - done);
+            if (wrote <= 0)
+                break;
+            done += (uint64_t)wrote;
+        }
+
+        ok = done == header->file_bytes && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temp_path, writer->path) == 0;
+    }
+
+    if (ok)
+        writer->written++;
+    else
+        writer->failed++;
+
+    atomic_store_explicit(&writer->busy, false, memory_order_release);
+    return NULL;
+}
+
+// the buffer to fill in for the next checkpoint, NULL while the last one is still being written.
+static inline uint8_t *checkpoint_begin(CheckpointWriter *writer)
+{
+    if (atomic_load_explicit(&writer->busy, memory_order_acquire))
+    {
+        writer->refused++;
+        return NULL;
+    }
+
+    if (writer->started)
+    {
+        pthread_join(writer->thread, NULL);
+        writer->started = false;
+    }
+
+    return writer->buffer;
+}
+
+// writes the filled in buffer to path in the background. false if the thread couldn't be started.
+static inline bool checkpoint_commit(CheckpointWriter *writer, const char *path)
+{
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+
+    atomic_store_explicit(&writer->busy, true, memory_order_relaxed);
+
+    if (pthread_create(&writer->thread, NULL, checkpoint_write_thread, writer) != 0)
+    {
+        atomic_store_explicit(&writer->busy, false, memory_order_relaxed);
+        return false;
+    }
+
+    writer->started = true;
+    return true;
+}
+
+// waits for the checkpoint being written, if any.
+static inline void checkpoint_finish(CheckpointWriter *writer)
+{
+    if (writer->started)
+        pthread_join(writer->thread, NULL);
+
+    writer->started = false;
+}
+
+// maps a checkpoint file and checks it. NULL with *error set if it isn't a whole checkpoint of this version.
+// unmap with checkpoint_unmap once everything has been copied out.
+static inline const CheckpointHeader *checkpoint_map(const char *path, const char **error)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        close(fd);
+        *error = "too short for a checkpoint";
+        return NULL;
+    }
+
+    void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED)
+    {
+        *error = strerror(errno);
+        return NULL;
+    }
+
+    const CheckpointHeader *header = mapped;
+    const uint8_t *bytes = mapped;
+    CheckpointHeader expected;
+    checkpoint_layout(&expected, header->num_balls, header->event_bytes);
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+        *error = "not a checkpoint";
+    else if (header->version != CHECKPOINT_VERSION || header->header_bytes != sizeof(CheckpointHeader))
+        *error = "checkpoint from a different version";
+    else if (header->num_balls < 1 || header->file_bytes != (uint64_t)info.st_size || header->file_bytes != expected.file_bytes ||
+             header->x != expected.x || header->y != expected.y || header->vx != expected.vx ||
+             header->vy != expected.vy || header->color != expected.color || header->size != expected.size || header->events != expected.events)
+        *error = "checkpoint is truncated or damaged";
+    else if (header->checksum != checkpoint_checksum(bytes + sizeof(CheckpointHeader), header->file_bytes - sizeof(CheckpointHeader)))
+        *error = "checkpoint checksum does not match";
+    else
+        return header;
+
+    munmap(mapped, (size_t)info.st_size);
+    return NULL;
+}
+
+static inline void checkpoint_unmap(const CheckpointHeader *header)
+{
+    munmap((void *)(uintptr_t)header, header->file_bytes);
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "ring.h"
+
+/*
+the encoder runs as a child process reading raw frames from a pipe on its stdin. frames go into the pipe
+with vmsplice, which hands the pipe references to the frame's pages instead of copying them, so the only copy
+left is the encoder's own read. the catch is that a frame must not be drawn over until the encoder has read it.
+after encoder_write returns the pipe can still reference the last pipe_frames frames, older ones are free.
+needs _GNU_SOURCE before the first include.
+*/
+
+
+
+
+typedef struct
+{
+    pid_t pid;
+    int fd;           // write end of the pipe, non blocking
+    size_t frame_bytes;
+    int pipe_bytes;   // what the kernel gave us, may be less than asked for
+    int pipe_frames;  // newest frames the pipe may still be reading from after encoder_write returns
+    Stalls stalls;    // encoder_write waiting for the encoder to make room in the pipe
+} Encoder;
+
+
+
+
+// the frames given to encoder_write must start on a page for the pipe to take whole pages.
+static inline size_t encoder_page_size()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// starts argv[0] with a pipe of about pipe_bytes on its stdin. false with errno set if it couldn't.
+static inline bool encoder_start(Encoder *encoder, char *const argv[], const size_t frame_bytes, const int pipe_bytes)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return false;
+
+    // the default pipe is 64 KB, 16 pages. a bigger one lets the encoder fall further behind before we wait.
+    // past /proc/sys/fs/pipe-max-size this fails for unprivileged users, which is fine, we just keep what we have.
+    (void)fcntl(fds[1], F_SETPIPE_SZ, pipe_bytes);
+
+    // an encoder that dies should show up as an error from encoder_write, not kill us.
+    signal(SIGPIPE, SIG_IGN);
+
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    close(fds[0]);
+
+    const size_t page = encoder_page_size();
+    const size_t pages_per_frame = (frame_bytes + page - 1) / page;
+    const int pipe_size = fcntl(fds[1], F_GETPIPE_SZ);
+    const size_t pipe_pages = pipe_size > 0 ? (size_t)pipe_size / page : 16;
+
+    // every page of a frame takes one slot of the pipe. when the last page of a frame is in, the other
+    // pipe_pages - 1 slots can only hold pages of the frames right before it.
+    *encoder = (Encoder){
+        .pid = pid,
+        .fd = fds[1],
+        .frame_bytes = frame_bytes,
+        .pipe_bytes = pipe_size,
+        .pipe_frames = 1 + (int)((pipe_pages - 1 + pages_per_frame - 1) / pages_per_frame),
+    };
+
+    fcntl(encoder->fd, F_SETFL, fcntl(encoder->fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+// hands one page aligned frame to the encoder, waiting while the pipe is full. false with errno set
+// if the encoder went away. don't draw into frame again until pipe_frames more frames have been written.
+static inline bool encoder_write(Encoder *encoder, const uint8_t *frame)
+{
+    struct iovec left = {(void *)(uintptr_t)frame, encoder->frame_bytes};
+
+    while (left.iov_len)
+    {
+        const ssize_t spliced = vmsplice(encoder->fd, &left, 1, SPLICE_F_NONBLOCK);
+
+        if (spliced > 0)
+        {
+            left.iov_base = (uint8_t *)left.iov_base + spliced;
+            left.iov_len -= (size_t)spliced;
+            continue;
+        }
+
+        if (spliced < 0 && errno == EINTR)
+            continue;
+
+        if (spliced < 0 && errno != EAGAIN)
+            return false;
+
+        // the pipe is full, the encoder is the bottleneck.
+        struct timespec since;
+        clock_gettime(CLOCK_MONOTONIC, &since);
+
+        struct pollfd ready = {.fd = encoder->fd, .events = POLLOUT};
+        while (poll(&ready, 1, -1) < 0)
+            if (errno != EINTR)
+                return false;
+
+        encoder->stalls.waits++;
+        encoder->stalls.wait_ms += ring_ms_since(&since);
+    }
+
+    return true;
+}
+
+// closes the pipe and waits for the encoder to finish. returns its exit status, -1 if it didn't exit normally.
+// the frames written can be freed once this returns.
+static inline int encoder_stop(Encoder *encoder)
+{
+    close(encoder->fd);
+    encoder->fd = -1;
+
+    int status;
+    while (waitpid(encoder->pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// runs argv[0] to the end, for the steps that don't take frames. returns its exit status,
+// -1 if it couldn't be started or didn't exit normally.
+static inline int encoder_run(char *const argv[])
+{
+    const pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (pid == 0)
+    {
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#endif
@@ -0,0 +1,525 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+/*
+event driven physics for identical elastic balls. instead of moving every ball a frame at a time and pushing apart
+the ones that ended up overlapping, the exact time every ball next hits another ball, a wall or the edge of its
+cell is worked out, and those events are done one at a time in time order. between events a ball flies in a
+straight line, so it is only touched when something happens to it, and where it is on a frame is worked out from
+where it was at its last event. balls never overlap and can't pass through each other at any speed.
+
+every ball keeps only its own next event, and the balls sit in a heap by the time of it. an event with another
+ball goes stale when that ball has a collision of its own first, which shows as its collision count having moved
+on. the stale event is dropped when it comes up and the ball's next event worked out again.
+times are in frames, positions are of the top left corner of a ball like everywhere else. doubles throughout, the
+callers' float arrays are only written when a frame is drawn.
+*/
+
+
+
+
+// cells are at least this many ball sizes wide, so two touching balls are always in neighbouring cells even
+// with the rounding of where a ball is, and as wide as the space around each ball in a sparse scene, so the
+// balls there don't spend their events crossing cells.
+#define EVENTS_CELL_MARGIN 1.01
+#define EVENTS_BALLS_PER_CELL 1.0
+
+#define EVENTS_NEVER 1e300
+
+// what a ball's next event is with. balls are 0 and up, the rest sort before them when two events are at once.
+enum { EVENT_NONE = -5, EVENT_WALL_Y, EVENT_WALL_X, EVENT_CROSS_Y, EVENT_CROSS_X };
+
+typedef struct
+{
+    double time;
+    int with;                // another ball or one of the EVENT_ values
+    uint32_t with_count;     // collision count of the other ball when this was worked out
+} Event;
+
+typedef struct
+{
+    uint64_t events;     // taken off the heap, including stale ones
+    uint64_t collisions;
+    uint64_t bounces;    // off a wall
+    uint64_t crossings;  // into another cell
+    uint64_t stale;
+    uint64_t pair_tests; // balls tested for a collision while working out next events
+} EventCounts;
+
+typedef struct
+{
+    int num_balls;
+    double size;             // ball diameter
+    double x_limit, y_limit; // furthest a corner goes, the world less a ball
+    double cell_width, cell_height;
+    int cols, rows;
+    double now;
+
+    // every ball as it was at its own time t, when it last had an event.
+    double *x, *y, *vx, *vy, *t;
+    uint32_t *count; // collisions so far
+    int *cell;
+    Event *next;
+
+    // the balls of every cell as lists ended by -1, and the balls by next event time with where each is in the heap.
+    int *cell_head, *cell_next, *cell_prev;
+    int *heap, *heap_slot;
+
+    EventCounts frame, total; // frame is the last events_advance
+} Events;
+
+
+
+
+static inline bool events_before(const double time_a, const int a, const double time_b, const int b)
+{
+    return time_a < time_b || (!(time_a > time_b) && a < b);
+}
+
+// allocates an engine for num_balls balls of size in a world_width x world_height world. false with errno set if
+// there isn't the memory. the balls come from events_load or events_restore.
+static inline bool events_start(Events *events, const int num_balls, const int size, const int world_width, const int world_height)
+{
+    memset(events, 0, sizeof(*events));
+    events->num_balls = num_balls;
+    events->size = size;
+    events->x_limit = world_width - size;
+    events->y_limit = world_height - size;
+
+    const double spread = sqrt(events->x_limit * events->y_limit * EVENTS_BALLS_PER_CELL / num_balls);
+    const double side = fmax(size * EVENTS_CELL_MARGIN, spread);
+
+    events->cols = events->x_limit > side ? (int)(events->x_limit / side) : 1;
+    events->rows = events->y_limit > side ? (int)(events->y_limit / side) : 1;
+    events->cell_width = fmax(events->x_limit / events->cols, 1.0);
+    events->cell_height = fmax(events->y_limit / events->rows, 1.0);
+
+    const size_t n = (size_t)num_balls;
+    const size_t cells = (size_t)events->cols * (size_t)events->rows;
+
+    events->x = malloc(n * sizeof(double));
+    events->y = malloc(n * sizeof(double));
+    events->vx = malloc(n * sizeof(double));
+    events->vy = malloc(n * sizeof(double));
+    events->t = malloc(n * sizeof(double));
+    events->count = malloc(n * sizeof(uint32_t));
+    events->cell = malloc(n * sizeof(int));
+    events->next = malloc(n * sizeof(Event));
+    events->cell_head = malloc(cells * sizeof(int));
+    events->cell_next = malloc(n * sizeof(int));
+    events->cell_prev = malloc(n * sizeof(int));
+    events->heap = malloc(n * sizeof(int));
+    events->heap_slot = malloc(n * sizeof(int));
+
+    if (events->x && events->y && events->vx && events->vy && events->t && events->count && events->cell && events->next &&
+        events->cell_head && events->cell_next && events->cell_prev && events->heap && events->heap_slot)
+        return true;
+
+    errno = ENOMEM;
+    return false;
+}
+
+static inline void events_stop(Events *events)
+{
+    free(events->x);
+    free(events->y);
+    free(events->vx);
+    free(events->vy);
+    free(events->t);
+    free(events->count);
+    free(events->cell);
+    free(events->next);
+    free(events->cell_head);
+    free(events->cell_next);
+    free(events->cell_prev);
+    free(events->heap);
+    free(events->heap_slot);
+    memset(events, 0, sizeof(*events));
+}
+
+static inline int events_cell_of(const Events *events, const double x, const double y)
+{
+    int col = (int)(x / events->cell_width);
+    int row = (int)(y / events->cell_height);
+
+    if (col < 0) col = 0;
+    if (row < 0) row = 0;
+    if (col >= events->cols) col = events->cols - 1;
+    if (row >= events->rows) row = events->rows - 1;
+
+    return row * events->cols + col;
+}
+
+static inline void events_link(Events *events, const int i)
+{
+    const int head = events->cell_head[events->cell[i]];
+
+    events->cell_prev[i] = -1;
+    events->cell_next[i] = head;
+    if (head >= 0)
+        events->cell_prev[head] = i;
+    events->cell_head[events->cell[i]] = i;
+}
+
+static inline void events_unlink(Events *events, const int i)
+{
+    const int prev = events->cell_prev[i], next = events->cell_next[i];
+
+    if (prev >= 0)
+        events->cell_next[prev] = next;
+    else
+        events->cell_head[events->cell[i]] = next;
+
+    if (next >= 0)
+        events->cell_prev[next] = prev;
+}
+
+static inline bool events_heap_less(const Events *events, const int a, const int b)
+{
+    return events_before(events->next[a].time, a, events->next[b].time, b);
+}
+
+static inline void events_heap_swap(Events *events, const int slot_a, const int slot_b)
+{
+    const int a = events->heap[slot_a], b = events->heap[slot_b];
+    events->heap[slot_a] = b;
+    events->heap[slot_b] = a;
+    events->heap_slot[a] = slot_b;
+    events->heap_slot[b] = slot_a;
+}
+
+static inline void events_heap_down(Events *events, int slot)
+{
+    for (;;)
+    {
+        const int left = 2 * slot + 1, right = left + 1;
+        int least = slot;
+
+        if (left < events->num_balls && events_heap_less(events, events->heap[left], events->heap[least]))
+            least = left;
+        if (right < events->num_balls && events_heap_less(events, events->heap[right], events->heap[least]))
+            least = right;
+        if (least == slot)
+            break;
+
+        events_heap_swap(events, slot, least);
+        slot = least;
+    }
+}
+
+// puts ball i back in its place after its next event changed.
+static inline void events_heap_fix(Events *events, const int i)
+{
+    int slot = events->heap_slot[i];
+
+    while (slot > 0 && events_heap_less(events, i, events->heap[(slot - 1) / 2]))
+    {
+        events_heap_swap(events, slot, (slot - 1) / 2);
+        slot = (slot - 1) / 2;
+    }
+
+    events_heap_down(events, slot);
+}
+
+// moves ball i along its line to now.
+static inline void events_catch_up(Events *events, const int i)
+{
+    const double dt = events->now - events->t[i];
+    events->x[i] += events->vx[i] * dt;
+    events->y[i] += events->vy[i] * dt;
+    events->t[i] = events->now;
+}
+
+// frames from now until balls i and j touch, or EVENTS_NEVER if they don't. i has to be caught up to now.
+// balls that already overlap by a rounding error and are still closing collide right away.
+static inline double events_collision_in(const Events *events, const int i, const int j)
+{
+    const double dt_j = events->now - events->t[j];
+    const double rx = events->x[i] - (events->x[j] + events->vx[j] * dt_j);
+    const double ry = events->y[i] - (events->y[j] + events->vy[j] * dt_j);
+    const double vx = events->vx[i] - events->vx[j];
+    const double vy = events->vy[i] - events->vy[j];
+
+    const double b = rx * vx + ry * vy;
+    if (b >= 0.0)
+        return EVENTS_NEVER;
+
+    const double vv = vx * vx + vy * vy;
+    const double c = rx * rx + ry * ry - events->size * events->size;
+    const double discriminant = b * b - vv * c;
+
+    if (discriminant < 0.0)
+        return EVENTS_NEVER;
+
+    // the smaller root, written so it doesn't lose everything to cancellation when b is large.
+    return c > 0.0 ? c / (-b + sqrt(discriminant)) : 0.0;
+}
+
+// frames from now until a ball at x moving at v along an axis hits a wall or leaves cell col of cells, and which.
+static inline double events_axis_in(const double x, const double v, const double limit, const int col, const int cols,
+                                    const double cell, const int wall, const int cross, int *with)
+{
+    if (v > 0.0)
+    {
+        *with = col < cols - 1 ? cross : wall;
+        return fmax(((col < cols - 1 ? (col + 1) * cell : limit) - x) / v, 0.0);
+    }
+
+    if (v < 0.0)
+    {
+        *with = col > 0 ? cross : wall;
+        return fmax(((col > 0 ? col * cell : 0.0) - x) / v, 0.0);
+    }
+
+    *with = EVENT_NONE;
+    return EVENTS_NEVER;
+}
+
+// works out the next event of ball i, which has to be caught up to now.
+static inline void events_predict(Events *events, const int i)
+{
+    const int col = events->cell[i] % events->cols;
+    const int row = events->cell[i] / events->cols;
+
+    Event best = {EVENTS_NEVER, EVENT_NONE, 0};
+    int with;
+
+    double in = events_axis_in(events->x[i], events->vx[i], events->x_limit, col, events->cols, events->cell_width,
+                               EVENT_WALL_X, EVENT_CROSS_X, &with);
+    if (events_before(events->now + in, with, best.time, best.with))
+        best = (Event){events->now + in, with, 0};
+
+    in = events_axis_in(events->y[i], events->vy[i], events->y_limit, row, events->rows, events->cell_height,
+                        EVENT_WALL_Y, EVENT_CROSS_Y, &with);
+    if (events_before(events->now + in, with, best.time, best.with))
+        best = (Event){events->now + in, with, 0};
+
+    const int col0 = col > 0 ? col - 1 : col, col1 = col < events->cols - 1 ? col + 1 : col;
+    const int row0 = row > 0 ? row - 1 : row, row1 = row < events->rows - 1 ? row + 1 : row;
+
+    for (int r = row0; r <= row1; r++)
+        for (int c = col0; c <= col1; c++)
+            for (int j = events->cell_head[r * events->cols + c]; j >= 0; j = events->cell_next[j])
+            {
+                if (j == i)
+                    continue;
+
+                events->frame.pair_tests++;
+                in = events_collision_in(events, i, j);
+
+                if (in < EVENTS_NEVER && events_before(events->now + in, j, best.time, best.with))
+                    best = (Event){events->now + in, j, events->count[j]};
+            }
+
+    events->next[i] = best;
+}
+
+// equal masses and no losses: the balls swap the parts of their velocities along the line between them.
+static inline void events_collide(Events *events, const int i, const int j)
+{
+    const double dx = events->x[i] - events->x[j];
+    const double dy = events->y[i] - events->y[j];
+    const double dist = sqrt(dx * dx + dy * dy);
+
+    if (dist > 0.0)
+    {
+        const double nx = dx / dist, ny = dy / dist;
+        const double along = (events->vx[i] - events->vx[j]) * nx + (events->vy[i] - events->vy[j]) * ny;
+
+        events->vx[i] -= along * nx;
+        events->vy[i] -= along * ny;
+        events->vx[j] += along * nx;
+        events->vy[j] += along * ny;
+    }
+
+    events->count[i]++;
+    events->count[j]++;
+}
+
+// puts every ball in the list of its cell.
+static inline void events_fill_cells(Events *events)
+{
+    const int cells = events->cols * events->rows;
+    for (int c = 0; c < cells; c++)
+        events->cell_head[c] = -1;
+
+    for (int i = 0; i < events->num_balls; i++)
+        events_link(events, i);
+}
+
+// puts every ball in the heap by its next event. any valid heap gives the events in the same order,
+// events_before has no ties.
+static inline void events_fill_heap(Events *events)
+{
+    for (int i = 0; i < events->num_balls; i++)
+    {
+        events->heap[i] = i;
+        events->heap_slot[i] = i;
+    }
+
+    for (int slot = events->num_balls / 2 - 1; slot >= 0; slot--)
+        events_heap_down(events, slot);
+}
+
+// starts from the balls in the float arrays at time now.
+static inline void events_load(Events *events, const float *x, const float *y, const float *vx, const float *vy, const double now)
+{
+    events->now = now;
+
+    for (int i = 0; i < events->num_balls; i++)
+    {
+        events->x[i] = x[i];
+        events->y[i] = y[i];
+        events->vx[i] = vx[i];
+        events->vy[i] = vy[i];
+        events->t[i] = now;
+        events->count[i] = 0;
+        events->cell[i] = events_cell_of(events, x[i], y[i]);
+    }
+
+    events_fill_cells(events);
+
+    for (int i = 0; i < events->num_balls; i++)
+        events_predict(events, i);
+
+    events_fill_heap(events);
+    memset(&events->frame, 0, sizeof(events->frame));
+}
+
+// does every event before until, and leaves the engine at until.
+static inline void events_advance(Events *events, const double until)
+{
+    memset(&events->frame, 0, sizeof(events->frame));
+
+    while (events->next[events->heap[0]].time < until)
+    {
+        const int i = events->heap[0];
+        const Event event = events->next[i];
+
+        events->now = event.time;
+        events->frame.events++;
+        events_catch_up(events, i);
+
+        if (event.with >= 0)
+        {
+            const int j = event.with;
+
+            if (events->count[j] != event.with_count)
+                events->frame.stale++;
+            else
+            {
+                events_catch_up(events, j);
+                events_collide(events, i, j);
+                events->frame.collisions++;
+
+                events_predict(events, j);
+                events_heap_fix(events, j);
+            }
+        }
+        else if (event.with == EVENT_WALL_X || event.with == EVENT_WALL_Y)
+        {
+            if (event.with == EVENT_WALL_X)
+            {
+                events->x[i] = events->vx[i] > 0.0 ? events->x_limit : 0.0;
+                events->vx[i] = -events->vx[i];
+            }
+            else
+            {
+                events->y[i] = events->vy[i] > 0.0 ? events->y_limit : 0.0;
+                events->vy[i] = -events->vy[i];
+            }
+
+            events->count[i]++;
+            events->frame.bounces++;
+        }
+        else
+        {
+            const int step = event.with == EVENT_CROSS_X ? (events->vx[i] > 0.0 ? 1 : -1) : (events->vy[i] > 0.0 ? events->cols : -events->cols);
+
+            events_unlink(events, i);
+            events->cell[i] += step;
+            events_link(events, i);
+            events->frame.crossings++;
+        }
+
+        events_predict(events, i);
+        events_heap_fix(events, i);
+    }
+
+    events->now = until;
+
+    events->total.events += events->frame.events;
+    events->total.collisions += events->frame.collisions;
+    events->total.bounces += events->frame.bounces;
+    events->total.crossings += events->frame.crossings;
+    events->total.stale += events->frame.stale;
+    events->total.pair_tests += events->frame.pair_tests;
+}
+
+// where ball i is now.
+static inline void events_position(const Events *events, const int i, float *x, float *y, float *vx, float *vy)
+{
+    const double dt = events->now - events->t[i];
+    *x = (float)(events->x[i] + events->vx[i] * dt);
+    *y = (float)(events->y[i] + events->vy[i] * dt);
+    *vx = (float)events->vx[i];
+    *vy = (float)events->vy[i];
+}
+
+// the state of the engine for a checkpoint: now, then the per ball arrays one after the other. the cell lists
+// and the heap are made again from them, and give the same events in the same order.
+static inline uint64_t events_state_bytes(const int num_balls)
+{
+    const uint64_t n = (uint64_t)num_balls;
+    return sizeof(double) + n * (5 * sizeof(double) + sizeof(uint32_t) + sizeof(int) + sizeof(Event));
+}
+
+#define EVENTS_STATE_ARRAYS(events, n, X)\
+    X(&(events)->now, sizeof(double))\
+    X((events)->x, (n) * sizeof(double))\
+    X((events)->y, (n) * sizeof(double))\
+    X((events)->vx, (n) * sizeof(double))\
+    X((events)->vy, (n) * sizeof(double))\
+    X((events)->t, (n) * sizeof(double))\
+    X((events)->count, (n) * sizeof(uint32_t))\
+    X((events)->cell, (n) * sizeof(int))\
+    X((events)->next, (n) * sizeof(Event))
+
+static inline void events_save(const Events *events, uint8_t *state)
+{
+    const size_t n = (size_t)events->num_balls;
+
+    #define SAVE_ARRAY(array, bytes) { memcpy(state, array, bytes); state += (bytes); }
+    EVENTS_STATE_ARRAYS(events, n, SAVE_ARRAY)
+    #undef SAVE_ARRAY
+}
+
+// false if the state doesn't make sense for this engine, a damaged file that got past its checksum.
+static inline bool events_restore(Events *events, const uint8_t *state)
+{
+    const size_t n = (size_t)events->num_balls;
+
+    #define RESTORE_ARRAY(array, bytes) { memcpy(array, state, bytes); state += (bytes); }
+    EVENTS_STATE_ARRAYS(events, n, RESTORE_ARRAY)
+    #undef RESTORE_ARRAY
+
+    for (int i = 0; i < events->num_balls; i++)
+        if (events->cell[i] < 0 || events->cell[i] >= events->cols * events->rows ||
+            events->next[i].with < EVENT_NONE || events->next[i].with >= events->num_balls)
+            return false;
+
+    events_fill_cells(events);
+    events_fill_heap(events);
+    memset(&events->frame, 0, sizeof(events->frame));
+    memset(&events->total, 0, sizeof(events->total));
+    return true;
+}
+
+#endif
@@ -57,6 +57,8 @@ fflush(stdout);
 
 #define MALLOC(size) malloc_checked(size, __FILE__, __LINE__)
 
+#define ALIGNED_MALLOC(alignment, size) aligned_malloc_checked(alignment, size, __FILE__, __LINE__)
+
 
 
 
@@ -72,6 +74,19 @@ static inline void* malloc_checked(size_t size, const char *file, int line) {
 
 
 
+// aligned_alloc wants the size rounded up to a multiple of the alignment.
+static inline void* aligned_malloc_checked(size_t alignment, size_t size, const char *file, int line) {
+    void *ptr = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (!ptr) {
+        printf("%s:%d Memory allocation failed! Requested size: %zu bytes", file, line, size);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+
+
+
 #define MIN_FREE_MEMORY_MB 500 
 
 // Function to get available memory (Linux)
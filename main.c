@@ -1,5 +1,10 @@
+#define _GNU_SOURCE // vmsplice, F_SETPIPE_SZ
+
 #include <X11/Xutil.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <sys/shm.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdint.h>
@@ -10,45 +15,455 @@
 #include <omp.h>
 
 #include "macros.h"
-
+#include "simd.h"
+#include "ring.h"
+#include "random.h"
+#include "encoder.h"
+#include "schedule.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "stats.h"
+#include "events.h"
+
+// defaults for the scene settings. every one of them can be changed at startup, see print_usage().
 #define MUL 1
 #define WIN_WIDTH (1920 * MUL)
 #define WIN_HEIGHT (1080 * MUL)
 #define NUM_BALLS (85 * MUL * MUL)
 #define BALL_SIZE 40
-#define MAX_SPEED (10 / (FPS / 60))
+#define BALL_SIZE_MAX 0 // sizes are spread from BALL_SIZE up to this, 0 gives every ball BALL_SIZE
+#define WORLD_WIDTH 0 // the world is the size of the frame when these are 0
+#define WORLD_HEIGHT 0
+#define BASE_SPEED 10 // pixels per frame at 60 fps
 #define EPSILON 0.001f
 #define FPS 60
 #define NUM_SECONDS (30 * 60)
-#define NUM_FRAMES (NUM_SECONDS * FPS)
 
 
 // define RENDER to render the output
 #define RENDER
 
-// define SHOW to show the output in a window. can do both render and show at the same time.
+// define SHOW to show the output in a window. can do both render and show at the same time, the window shows
+// the frames drawn for ffmpeg so they're only drawn once.
 #define SHOWy
 
+// define PIPELINE to run physics, drawing and encoding on their own threads. only used with RENDER.
+#define PIPELINE
 
+// define YUV420 to draw planar yuv420 frames for ffmpeg, otherwise rgb24. yuv420 is half the bytes and ffmpeg
+// doesn't have to convert it.
+#define YUV420
 
-typedef struct
-{
-    float x, y;
-    float vx, vy;
-    unsigned long color;
-} Ball;
+// define SKIP_FRAMES to stop showing frames while the run is more than a frame behind, until it has caught up.
+// ffmpeg still gets every frame. otherwise the schedule slips, and the run slows down instead.
+#define SKIP_FRAMES
+
+// define DIRTY_REGIONS to keep every frame buffer and redraw only the boxes of the balls that moved.
+// the frames are the same either way.
+#define DIRTY_REGIONS
+
+// define VERIFY_BROAD_PHASE to run the old all-pairs loop next to the grid and check both find the same overlaps.
+#define VERIFY_BROAD_PHASEy
+
+// define EVENT_DRIVEN to move the balls from collision to collision in time order, see events.h, instead of a frame
+// at a time and pushing apart the ones that overlap. exact at any speed, and costs per collision instead of per frame.
+#define EVENT_DRIVENy
+
+// define STATS to count what the hot loops do and time the phases of every frame, see stats.h. --stats writes
+// them out. without it the STAT_ macros are empty and none of it is compiled in.
+#define STATS
+
+// the frame is drawn in tiles, each cleared and drawn by one thread. a tile is small enough to stay in cache.
+#define TILE_WIDTH 128
+#define TILE_HEIGHT 64
+
+// a tile with more dirty boxes than this is redrawn whole.
+#define DIRTY_BOXES_PER_TILE 8
+
+// below these sizes a phase runs on the calling thread, waking the omp team costs more than it would save.
+// balls for the light per ball loops, balls again for finding contacts, contacts for resolving them, neighbour pairs
+// for filtering the contacts out of them, dirty boxes for redrawing a frame, pixels for drawing or converting a whole one.
+#define PARALLEL_MIN_BALLS 8192
+#define PARALLEL_MIN_CONTACT_BALLS 1024
+#define PARALLEL_MIN_CONTACTS 2048
+#define PARALLEL_MIN_NEIGHBOUR_PAIRS 8192
+#define PARALLEL_MIN_DIRTY_BOXES 64
+#define PARALLEL_MIN_PIXELS 65536
+
+// contacts are found in this many blocks of balls per thread, taken by whichever thread is free next, so a
+// crowded part of the world doesn't hold the others up.
+#define CONTACT_BLOCKS_PER_THREAD 4
+
+// the broad phase keeps a list of the pairs of balls within a ball size plus this many pixels of each other, and
+// only goes back to the grid once some ball has moved half of it. 0 searches the grid on every frame instead.
+// a bigger skin is rebuilt less often but filters more pairs every frame. off by default: at 60 fps a ball can move
+// 14 px a frame, so any skin worth having is rebuilt every frame or two, and the grid is cheaper. it pays off at
+// high frame rates, where the balls move a few pixels a frame.
+#define NEIGHBOUR_SKIN 0
+
+// define PIN_THREADS to pin every thread of the omp team to a cpu of its own once at startup. ignored when
+// OMP_PROC_BIND is set, the omp runtime binds them itself then.
+#define PIN_THREADS
+
+// slots in the physics -> drawing and drawing -> encoding rings. the encoding ring gets a few more for
+// the frames the encoder pipe is still reading from, see encoder.h.
+#define SNAPSHOT_SLOTS 4
+#define FRAME_SLOTS 3
 
+// size of the pipe to the encoder. 1 MB is the most linux gives an unprivileged process by default.
+#define ENCODER_PIPE_BYTES (1 << 20)
 
+// write a checkpoint every this many seconds of video, 0 for none. --resume carries on from one, see checkpoint.h.
+#define CHECKPOINT_SECONDS 60
+
+// room for the text settings, file names.
+#define TEXT_OPTION_BYTES 256
+
+// headless benchmark: fixed seed, no pacing, window or ffmpeg. runs this many frames per ball count by default.
+#define BENCH_FRAMES 100
+#define BENCH_SEED 12345
+
+
+// structure of arrays so the hot loops can load a whole vector of balls at once.
+// x and y are the top left corner of the ball, color is packed 0xRRGGBB and yuv is the same colour packed 0xYYUUVV.
+// size is the diameter and mass goes with the area. they only differ between balls when the sizes are mixed.
+// every array is SIMD_ALIGN aligned and padded to a multiple of 16 balls.
+typedef struct
+{
+    float *x, *y;
+    float *vx, *vy;
+    uint32_t *color;
+    uint32_t *yuv;
+    float *size, *mass;
+} Balls;
+
+
+
+
+// scene settings, from the defines above, the command line and the config file in that order.
+// the world is what the balls bounce around in, the frame shows the part of it the camera looks at.
+// benchmark runs grow the world with the ball count.
+int frame_width = WIN_WIDTH;
+int frame_height = WIN_HEIGHT;
+int world_width = WORLD_WIDTH;
+int world_height = WORLD_HEIGHT;
+int num_balls = NUM_BALLS;
+int ball_size = BALL_SIZE;
+int ball_size_max = BALL_SIZE_MAX;
+int fps = FPS;
+int num_seconds = NUM_SECONDS;
+char output_file[TEXT_OPTION_BYTES] = "out.mp4";
+int scene_seed = 0; // 0 picks one from the clock
+int checkpoint_seconds = CHECKPOINT_SECONDS;
+int neighbour_skin = NEIGHBOUR_SKIN;
+char checkpoint_prefix[TEXT_OPTION_BYTES] = "balls"; // checkpoints are <prefix>.<frame>.ckpt
+char resume_file[TEXT_OPTION_BYTES] = "";
+char stats_file[TEXT_OPTION_BYTES] = "";   // per frame counts and phase times, json if it ends in .json, csv otherwise
+char record_file[TEXT_OPTION_BYTES] = "";  // physics only, every frame goes to this trajectory file
+char play_file[TEXT_OPTION_BYTES] = "";    // draws the frames of this trajectory file instead of simulating
+int recolour_seed = 0;                     // with play_file, new colours from this seed, 0 keeps the recorded ones
+int num_segments = 1;                      // with play_file, pieces of the video encoded at the same time and joined after
+char batch_file[TEXT_OPTION_BYTES] = "";   // every line of it is a scene of its own, see run_batch
+int batch_jobs = 0;                        // with batch_file, scenes running at once, 0 for one per cpu
+
+// the camera starts with the world pixel camera_x, camera_y at the top left of the frame and moves pan_x, pan_y
+// world pixels a second, turning round at the edges of the world. zoom is frame pixels per world pixel, 0 is 1 for
+// a simulation and the whole world for play_file.
+int camera_x = 0;
+int camera_y = 0;
+float camera_zoom = 0.0f;
+float pan_x = 0.0f;
+float pan_y = 0.0f;
+
+#ifdef RENDER
+bool render = true;
+#else
+bool render = false;
+#endif
+
+#ifdef SHOW
+bool show = true;
+#else
+bool show = false;
+#endif
+
+#ifdef PIPELINE
+bool pipeline = true;
+#else
+bool pipeline = false;
+#endif
+
+#ifdef YUV420
+bool yuv420 = true;
+#else
+bool yuv420 = false;
+#endif
+
+#ifdef DIRTY_REGIONS
+bool dirty_regions = true;
+#else
+bool dirty_regions = false;
+#endif
+
+#ifdef SKIP_FRAMES
+bool skip_frames = true;
+#else
+bool skip_frames = false;
+#endif
+
+#ifdef PIN_THREADS
+bool pin_threads = true;
+#else
+bool pin_threads = false;
+#endif
+
+#ifdef EVENT_DRIVEN
+bool event_driven = true;
+#else
+bool event_driven = false;
+#endif
+
+// derived from the settings by apply_settings(), for drawing. the physics has its own, see Scene.
+bool mixed_sizes; // ball_size_max is past ball_size
+int draw_size, draw_size_max; // ball_size and ball_size_max zoomed
+uint32_t background_yuv;
+int num_tiles;
+size_t frame_bytes;
 
-Ball balls[NUM_BALLS];
 Display *display;
 Window window;
 XColor vscode_gray;
 GC gc;
-const float overlap_distance = (BALL_SIZE * BALL_SIZE) + EPSILON;
-struct timespec start = {0}, end = {0}; 
 
-FILE *ffmpeg;
+// the window is fed from the drawn frames through shared memory images. two take turns, so a frame can be
+// converted into one while the x server is still copying the other out. plain XPutImage without MIT-SHM.
+XImage *window_images[2];
+XShmSegmentInfo window_shm[2];
+bool window_busy[2];
+int window_image;
+bool window_uses_shm;
+int shm_completion;
+
+// frame deadlines, and how late the frames made it to the window.
+Schedule schedule;
+Lateness shown_lateness;
+uint64_t frames_not_shown;
+
+// checkpoints being written, and the one being resumed from until its arrays are copied out.
+CheckpointWriter checkpoints;
+const CheckpointHeader *resume;
+uint64_t first_frame;
+
+// the trajectory being played back.
+const TrajectoryHeader *playback;
+
+// grids of balls of mixed sizes, one per size level, see Scene and mixed_kernels.h.
+#define MAX_SIZE_LEVELS 16
+
+// overlapping pairs found by the broad phase are sorted by colour. no ball appears twice in one colour,
+// so each colour can be resolved in parallel. contacts that didn't get a colour go in the last, serial batch.
+#define MAX_COLOURS 64
+
+typedef struct
+{
+    int a, b;
+} Contact;
+
+typedef struct
+{
+    Contact *contacts;
+    int count, capacity;
+} ContactList;
+
+typedef struct Scene Scene;
+
+// the physics of a frame, compiled for one ball size, see select_physics.
+typedef struct
+{
+    int ball_size; // 0 matches any size
+    void (*integrate_balls)(Scene *scene);
+    void (*broad_phase)(Scene *scene);
+    void (*narrow_phase)(Scene *scene);
+} PhysicsKernels;
+
+// one simulation: its settings, its balls, and everything the physics keeps from one frame to the next. the physics
+// only touches the scene it is handed, so a batch steps many of them at once, see run_batch. a run that isn't a
+// batch steps main_scene, which is also the one drawn, checkpointed and played back into.
+struct Scene
+{
+    // copied from the settings by scene_settings, so a batch can give every scene its own.
+    int world_width, world_height;
+    int num_balls, ball_size, ball_size_max;
+    int fps, seed, neighbour_skin;
+    bool event_driven;
+
+    // derived from those by alloc_scene.
+    bool mixed_sizes; // ball_size_max is past ball_size
+    float max_speed;
+    const PhysicsKernels *physics;
+
+    Balls balls;
+
+    // balls sorted by cell. the balls of cell c are cell_balls[cell_start[c] .. cell_start[c + 1]].
+    // cells are one ball plus the neighbour skin wide, so two overlapping balls, or two neighbours, are always in the
+    // same or neighbouring cells.
+    int grid_cell_size, grid_cols, grid_rows, grid_cells;
+    int *cell_start;
+    int *cell_fill;
+    int *cell_balls;
+    int *ball_cell;
+
+    // positions copied in cell order when the grid is built, so a run of cells can be tested as one vector.
+    float *cell_x, *cell_y;
+
+    // balls of mixed sizes go in a grid per size level instead. level l has cells ball_size << l wide and holds the
+    // balls too big for the level below, by their centre. a level with far more cells than balls, the small balls of a
+    // world taken up by big ones, is hashed into a table of level_slots slots instead, see level_slot.
+    // the slots of every level follow on from the ones of the level before, level l starts at slot level_first[l] of
+    // the arrays above. cell_x and cell_y hold the centres then, and cell_r the radius.
+    int num_levels;
+    int level_cell[MAX_SIZE_LEVELS], level_cols[MAX_SIZE_LEVELS], level_rows[MAX_SIZE_LEVELS];
+    int level_slots[MAX_SIZE_LEVELS];
+    bool level_hashed[MAX_SIZE_LEVELS];
+    int level_first[MAX_SIZE_LEVELS + 1];
+    int level_balls[MAX_SIZE_LEVELS]; // levels without balls are never searched
+    uint8_t *ball_level;
+    float *cell_r;
+
+    // the overlapping pairs of the frame, and the same sorted by colour.
+    ContactList found_contacts, coloured_contacts;
+    ContactList *block_contacts;
+    int num_block_lists;
+
+    // pairs within a ball size plus neighbour_skin, sorted by first ball and then partner, and where every ball was
+    // when they were found. the contacts are the ones of these pairs that overlap, until a ball has moved half the skin.
+    ContactList neighbour_pairs;
+    float *built_x, *built_y;
+    bool neighbours_built;
+    uint64_t neighbour_builds, broad_phases;
+    uint8_t *contact_colour;
+    int contact_colour_capacity;
+    uint64_t *ball_colours;
+    int colour_start[MAX_COLOURS + 2];
+
+    // the event driven engine, when the balls are moved by it.
+    Events events;
+
+    // the trajectory being recorded, if any.
+    TrajectoryWriter trajectory;
+
+#ifdef STATS
+    Stats stats;
+#endif
+};
+
+Scene main_scene;
+
+// pixel rectangle, x0 and y0 inclusive, x1 and y1 exclusive.
+typedef struct
+{
+    int x0, y0, x1, y1;
+} Rect;
+
+// balls and dirty boxes sorted by tile, redone for every frame.
+typedef struct
+{
+    // balls touching each tile in index order. the balls of tile t are tile_balls[tile_start[t] .. tile_start[t + 1]].
+    int *tile_start;
+    int *tile_fill;
+    int *tile_balls;
+    int tile_balls_capacity;
+
+    // the dirty boxes of a frame cut up by tile. the boxes of tile t are dirty_boxes[dirty_start[t] .. dirty_start[t + 1]].
+    int *dirty_start;
+    int *dirty_fill;
+    Rect *dirty_boxes;
+    int dirty_boxes_capacity;
+} TileBins;
+
+// a frame buffer that remembers where it drew every ball, so the next frame drawn into it only redraws what moved.
+// it has its own tile bins as well, so different canvases can be drawn at the same time.
+typedef struct
+{
+    uint8_t *pixels;        // rgb24 or yuv420 planes, see yuv420
+    int *drawn_balls;       // the balls of the last frame drawn here in index order, see Shown
+    int num_drawn;
+    int *drawn_x, *drawn_y; // pixel each of those was centred on, by ball
+    bool drawn;             // false until a whole frame was drawn
+    TileBins bins;
+} Canvas;
+
+// where the frame looks into the world: the world pixel at its top left corner, and frame pixels per world pixel.
+typedef struct
+{
+    float x, y, zoom;
+} Camera;
+
+// the balls a frame shows, in index order so later balls still draw on top, with the top left corner of ball
+// balls[k] at x[k], y[k] in frame pixels. only these are drawn, the rest of the world costs the renderer nothing.
+typedef struct
+{
+    int count;
+    int *balls;
+    float *x, *y;
+} Shown;
+
+// bytes written into frame buffers, and frames drawn, over the whole run.
+_Atomic uint64_t bytes_touched;
+_Atomic uint64_t frames_drawn;
+
+// the phases of a simulated frame that --stats times. output is drawing, handing to the pipeline or recording.
+// an event driven run does its collisions under events and works out where the balls are for the frame under integrate.
+enum { STATS_INTEGRATE, STATS_BROAD, STATS_NARROW, STATS_EVENTS, STATS_OUTPUT, NUM_STATS_PHASES };
+const char *const stats_phase_names[NUM_STATS_PHASES] = {"integrate", "broad", "narrow", "events", "output"};
+
+// STAT_LOCAL declares a per thread count that STAT_ADD_LOCAL adds to, STAT_COUNT adds a count to the frame of the
+// scene being stepped, STAT_COUNT_IN to the frame of any scene. the others mark the phases of the scene's frame.
+// n is still evaluated by STAT_ADD_LOCAL without STATS, so it can wrap a call that has to happen anyway.
+#ifdef STATS
+#define STAT_LOCAL(name) uint64_t name = 0
+#define STAT_ADD_LOCAL(name, n) ((name) += (uint64_t)(n))
+#define STAT_COUNT_IN(of, counter, n) atomic_fetch_add_explicit(&(of)->stats.counts[counter], (uint64_t)(n), memory_order_relaxed)
+#define STAT_COUNT(counter, n) STAT_COUNT_IN(scene, counter, n)
+#define STAT_BEGIN_FRAME() {if (scene->stats.file) stats_begin_frame(&scene->stats);}
+#define STAT_END_PHASE(phase) {if (scene->stats.file) stats_end_phase(&scene->stats, phase);}
+#define STAT_END_FRAME(frame) {if (scene->stats.file) stats_end_frame(&scene->stats, frame);}
+#else
+#define STAT_LOCAL(name)
+#define STAT_ADD_LOCAL(name, n) ((void)(n))
+#define STAT_COUNT_IN(of, counter, n)
+#define STAT_COUNT(counter, n)
+#define STAT_BEGIN_FRAME()
+#define STAT_END_PHASE(phase)
+#define STAT_END_FRAME(frame)
+#endif
+
+// half width of every row of a ball as drawn. row dy of a ball centred on (cx, cy) covers
+// cx - ball_spans[dy + radius] .. cx + ball_spans[dy + radius], the same pixels as dx * dx + dy * dy <= radius * radius.
+int *ball_spans;
+
+// the same for every radius up to draw_size_max / 2 when the sizes are mixed, radius r starting at radius_spans[radius_start[r]],
+// and the diameter in frame pixels every ball is drawn at.
+int *radius_spans, *radius_start;
+int *draw_sizes;
+
+// the balls shown at the end of one physics step. colours never change so they aren't copied.
+Shown snapshots[SNAPSHOT_SLOTS];
+
+// the balls shown by a frame drawn on the physics thread, without the pipeline.
+Shown frame_shown;
+// frames drawn for the encoder. the pipeline passes them around frame_ring, otherwise they're used in turn.
+Canvas *frames;
+int frames_in_flight;
+Ring snapshot_ring = {.size = SNAPSHOT_SLOTS};
+Ring frame_ring;
+pthread_t draw_thread, encode_thread;
+int physics_threads, draw_threads; // the omp teams of the physics and drawing stages, see split_team
+
+// physics waiting for a free snapshot, drawing waiting for a snapshot or a free frame, encoding waiting for a frame.
+Stalls physics_stalls, draw_input_stalls, draw_output_stalls, encode_stalls;
+
+Encoder encoder;
 
 // merge the music and audio
 // ffmpeg -i out.mp4 -i music.mp3 -c:v copy -c:a aac -shortest Balls.mp4
@@ -56,345 +471,3093 @@ FILE *ffmpeg;
 
 
 
-bool is_overlapping(const Ball *a, const Ball *b)
+// every ball draws its position, velocity and colour from its own stream, so a seed always gives the same scene.
+enum { STREAM_POSITION, STREAM_VELOCITY, STREAM_COLOUR, NUM_STREAMS };
+
+// placement grid for make_balls. cells are ball_size / sqrt(2) wide, so no cell can hold two balls
+// and every ball that could overlap a new one is within 2 cells of it. a cell holds the position of its ball,
+// empty cells hold a position so far away that nothing ever overlaps it, so the test needs no branches.
+typedef struct
+{
+    float x, y;
+} Point;
+
+typedef struct
+{
+    Point *cells;
+    int cols, rows;
+    float cell_size;
+    float overlap; // squared distance under which two balls overlap
+} PlacementGrid;
+
+#define EMPTY_CELL -1e9f
+
+// at most this many rounds of dart throwing over the whole world before the empty cells are swept instead.
+// the sweep also starts early once a round places fewer than 1 / PLACEMENT_MIN_YIELD of the balls it tried.
+#define PLACEMENT_ROUNDS 32
+#define PLACEMENT_MIN_YIELD 8
+
+// darts thrown into one empty cell by the sweep, and the width in cells of the blocks it visits.
+#define SWEEP_DARTS 16
+#define SWEEP_BLOCK 16
+
+// darts thrown for one ball of a mixed size scene before giving up on it.
+#define MIXED_PLACEMENT_DARTS 4096
+
+static inline bool position_is_free(const PlacementGrid *grid, const float x, const float y)
 {
-    const float dx = a->x - b->x;
-    const float dy = a->y - b->y;
-    return dx * dx + dy * dy < overlap_distance;
+    const int col = (int)(x / grid->cell_size);
+    const int row = (int)(y / grid->cell_size);
+    const int col0 = col > 1 ? col - 2 : 0;
+    const int col1 = col + 2 < grid->cols ? col + 2 : grid->cols - 1;
+    bool is_free = true;
+
+    for (int r = row > 1 ? row - 2 : 0; r <= row + 2 && r < grid->rows; r++)
+        for (int c = col0; c <= col1; c++)
+        {
+            const Point p = grid->cells[r * grid->cols + c];
+            is_free &= (x - p.x) * (x - p.x) + (y - p.y) * (y - p.y) >= grid->overlap;
+        }
+
+    return is_free;
 }
 
-void set_ball_position(const int i)
+static inline int placement_cell(const PlacementGrid *grid, const float x, const float y)
 {
-    Ball *ball = &balls[i];
-    int loop_count = 0;
+    return (int)(y / grid->cell_size) * grid->cols + (int)(x / grid->cell_size);
+}
 
-    MAKE_RANDOM_POSITION:
+static inline uint64_t greatest_common_divisor(uint64_t a, uint64_t b)
+{
+    while (b)
+    {
+        const uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
 
-    if (loop_count++ > 1<<16)
+/*
+dart throwing on a grid. every round, all the balls that still need a spot draw one in parallel and test it against
+the balls placed in earlier rounds. the hits are then placed one by one, rechecked against the hits before them.
+the balls are visited in row order, stable in the ball index, so the grid is read a few rows at a time rather than
+at random, and the scene only depends on the seed. once the rounds stop paying off, the empty cells are visited in a
+shuffled order and get a few darts each, which finds the last gaps of a dense scene far faster than throwing darts
+at the whole world.
+*/
+void place_balls(Scene *scene, const uint64_t seed)
+{
+    const float span_x = (float)(scene->world_width - scene->ball_size);
+    const float span_y = (float)(scene->world_height - scene->ball_size);
+
+    PlacementGrid grid;
+    grid.cell_size = (float)scene->ball_size / sqrtf(2.0f);
+    grid.overlap = (float)(scene->ball_size * scene->ball_size) + EPSILON;
+    grid.cols = (int)(span_x / grid.cell_size) + 1;
+    grid.rows = (int)(span_y / grid.cell_size) + 1;
+
+    const size_t num_cells = (size_t)grid.cols * (size_t)grid.rows;
+    grid.cells = MALLOC(num_cells * sizeof(Point));
+
+    #pragma omp parallel for schedule(static) if(num_cells >= PARALLEL_MIN_BALLS)
+    for (size_t c = 0; c < num_cells; c++)
+        grid.cells[c] = (Point){EMPTY_CELL, EMPTY_CELL};
+
+    int *pending = MALLOC((size_t)scene->num_balls * sizeof(int));
+    int *by_row = MALLOC((size_t)scene->num_balls * sizeof(int));
+    int *row_start = MALLOC((size_t)(grid.rows + 1) * sizeof(int));
+    Point *spots = MALLOC((size_t)scene->num_balls * sizeof(Point));
+    Point *spots_by_row = MALLOC((size_t)scene->num_balls * sizeof(Point));
+    uint8_t *looks_free = MALLOC((size_t)scene->num_balls);
+    int num_pending = scene->num_balls;
+
+    for (int i = 0; i < scene->num_balls; i++)
+        pending[i] = i;
+
+    for (int round = 0; round < PLACEMENT_ROUNDS && num_pending; round++)
     {
-        PR("%s", "Could not find a random position for a ball.");
-        exit(EXIT_FAILURE);
+        #pragma omp parallel for schedule(static) if(num_pending >= PARALLEL_MIN_BALLS)
+        for (int k = 0; k < num_pending; k++)
+        {
+            RandomStream stream = random_stream(seed, (uint64_t)pending[k] * NUM_STREAMS + STREAM_POSITION);
+            stream.counter = (uint64_t)round * 2;
+
+            spots[k].x = random_float(&stream) * span_x;
+            spots[k].y = random_float(&stream) * span_y;
+        }
+
+        memset(row_start, 0, (size_t)(grid.rows + 1) * sizeof(int));
+
+        for (int k = 0; k < num_pending; k++)
+            row_start[(int)(spots[k].y / grid.cell_size) + 1]++;
+
+        for (int r = 0; r < grid.rows; r++)
+            row_start[r + 1] += row_start[r];
+
+        for (int k = 0; k < num_pending; k++)
+        {
+            const int sorted = row_start[(int)(spots[k].y / grid.cell_size)]++;
+            by_row[sorted] = pending[k];
+            spots_by_row[sorted] = spots[k];
+        }
+
+        #pragma omp parallel for schedule(static) if(num_pending >= PARALLEL_MIN_BALLS)
+        for (int k = 0; k < num_pending; k++)
+            looks_free[k] = position_is_free(&grid, spots_by_row[k].x, spots_by_row[k].y);
+
+        int still_pending = 0;
+        for (int k = 0; k < num_pending; k++)
+        {
+            const Point spot = spots_by_row[k];
+            if (looks_free[k] && position_is_free(&grid, spot.x, spot.y))
+            {
+                scene->balls.x[by_row[k]] = spot.x;
+                scene->balls.y[by_row[k]] = spot.y;
+                grid.cells[placement_cell(&grid, spot.x, spot.y)] = spot;
+            }
+            else
+                pending[still_pending++] = by_row[k];
+        }
+
+        const int placed = num_pending - still_pending;
+        num_pending = still_pending;
+
+        if (placed * PLACEMENT_MIN_YIELD < num_pending + placed)
+            break;
     }
 
-    ball->x =  (float) (rand() % (WIN_WIDTH - BALL_SIZE*2)) + BALL_SIZE;
-    ball->y =  (float) (rand() % (WIN_HEIGHT - BALL_SIZE*2)) + BALL_SIZE;
-    ball->vx = (float) ((float)(rand() % 200) / 100.0f - 1.0f) * MAX_SPEED;
-    ball->vy = (float) ((float)(rand() % 200) / 100.0f - 1.0f) * MAX_SPEED;
+    if (num_pending)
+    {
+        // blocks of cells are visited in a shuffled order, a stride coprime with the block count reaches each once.
+        // the cells of a block are visited in row order, so the grid is read a few rows at a time.
+        const int block_cols = (grid.cols + SWEEP_BLOCK - 1) / SWEEP_BLOCK;
+        const uint64_t num_blocks = (uint64_t)block_cols * (uint64_t)((grid.rows + SWEEP_BLOCK - 1) / SWEEP_BLOCK);
+
+        RandomStream stream = random_stream(seed, (uint64_t)scene->num_balls * NUM_STREAMS);
+        const uint64_t first = random_next(&stream) % num_blocks;
+        uint64_t stride = random_next(&stream) % num_blocks | 1;
+
+        while (greatest_common_divisor(stride, num_blocks) != 1)
+            stride++;
+
+        for (uint64_t k = 0, block = first; k < num_blocks && num_pending; k++, block = (block + stride) % num_blocks)
+        {
+            const int col0 = (int)(block % (uint64_t)block_cols) * SWEEP_BLOCK;
+            const int row0 = (int)(block / (uint64_t)block_cols) * SWEEP_BLOCK;
+
+            for (int row = row0; row < row0 + SWEEP_BLOCK && row < grid.rows && num_pending; row++)
+                for (int col = col0; col < col0 + SWEEP_BLOCK && col < grid.cols && num_pending; col++)
+                {
+                    Point *cell = &grid.cells[row * grid.cols + col];
+                    if (cell->x >= 0.0f)
+                        continue;
+
+                    for (int dart = 0; dart < SWEEP_DARTS; dart++)
+                    {
+                        const float x = ((float)col + random_float(&stream)) * grid.cell_size;
+                        const float y = ((float)row + random_float(&stream)) * grid.cell_size;
+
+                        if (x < span_x && y < span_y && position_is_free(&grid, x, y))
+                        {
+                            const int i = pending[--num_pending];
+                            scene->balls.x[i] = x;
+                            scene->balls.y[i] = y;
+                            *cell = (Point){x, y};
+                            break;
+                        }
+                    }
+                }
+        }
+    }
 
-    for (int j = 0; j < i; j++)
-        if (is_overlapping(&balls[i], &balls[j]))
-            goto MAKE_RANDOM_POSITION;
+    if (num_pending)
+        PERROR("Could only fit %d of %d balls of %d px in a %dx%d world.",
+            scene->num_balls - num_pending, scene->num_balls, scene->ball_size, scene->world_width, scene->world_height);
+
+    free(grid.cells);
+    free(pending);
+    free(by_row);
+    free(row_start);
+    free(spots);
+    free(spots_by_row);
+    free(looks_free);
 }
 
-void generate_random_color(const int i)
+// the size level of a ball: the first one with cells at least as wide as the ball.
+static inline int size_level(const Scene *scene, const float size)
 {
-    uint8_t r, g, b;
-    int loop_count = 0;
+    int level = 0;
+    while (level < scene->num_levels - 1 && (float)scene->level_cell[level] < size)
+        level++;
+    return level;
+}
 
-    MAKE_NEW_COLOR:
+// the slot of cell (col, row) of level: its index in row order, wrapped around the slots of a hashed level. the cells
+// of a row stay next to each other that way, and cells that share a slot are far apart, see make_level_slots.
+// sharing a slot only costs the distance tests of the balls in it.
+static inline int level_slot(const Scene *scene, const int level, const int col, const int row)
+{
+    const int64_t cell = (int64_t)row * scene->level_cols[level] + col;
+    return scene->level_first[level] + (int)(scene->level_hashed[level] ? cell % scene->level_slots[level] : cell);
+}
 
-    if (loop_count++ > 1<<16)
-    {
-        PR("%s", "Could not find a random position for a ball.");
-        exit(EXIT_FAILURE);
-    }
+// the slot of level a ball centred on (cx, cy) is in.
+static inline int level_cell_of(const Scene *scene, const int level, const float cx, const float cy)
+{
+    int col = (int)(cx / (float)scene->level_cell[level]);
+    int row = (int)(cy / (float)scene->level_cell[level]);
 
-    r = (uint8_t)rand();
-    g = (uint8_t)rand();
-    b = (uint8_t)rand();
+    // balls can be pushed slightly past the walls by a collision.
+    if (col < 0) col = 0;
+    if (row < 0) row = 0;
+    if (col >= scene->level_cols[level]) col = scene->level_cols[level] - 1;
+    if (row >= scene->level_rows[level]) row = scene->level_rows[level] - 1;
 
-    // too dark
-    if ((int)r + (int)g + (int)b < 150)
-        goto MAKE_NEW_COLOR;
+    return level_slot(scene, level, col, row);
+}
 
-    // same color as the another ball.
-    for (int j = 0; j < i; ++j)
-        if (balls[i].color == balls[j].color)
-            goto MAKE_NEW_COLOR;
+// the columns, or rows, of level that a ball of any size the level holds has to be in to overlap a ball of
+// radius r centred on c. count is the number of columns or rows of the level.
+static inline void level_span(const Scene *scene, const int level, const float c, const float r, const int count, int *first, int *last)
+{
+    const float reach = r + 0.5f * (float)scene->level_cell[level] + EPSILON;
+    const int lo = (int)((c - reach) / (float)scene->level_cell[level]);
+    const int hi = (int)((c + reach) / (float)scene->level_cell[level]);
 
-    balls[i].color = (r << 16) | (g << 8) | b;   
+    *first = lo < 0 ? 0 : lo >= count ? count - 1 : lo;
+    *last = hi < 0 ? 0 : hi >= count ? count - 1 : hi;
 }
 
-void make_balls()
+// sizes spread evenly over the logarithm between ball_size and ball_size_max, so there are as many balls of
+// 10 to 20 px as of 100 to 200 px. they come from the velocity stream after the two numbers of the velocity, so a
+// scene of one size draws exactly what it always did. serial, so expf gives the same sizes whatever the threads.
+void pick_sizes(Scene *scene, const uint64_t seed)
 {
-    srand((unsigned int)time(NULL));
+    const float spread = logf((float)scene->ball_size_max / (float)scene->ball_size);
 
-    #pragma omp parallel for schedule (static)
-    for (int i = 0; i < NUM_BALLS; i++)
+    for (int i = 0; i < scene->num_balls; i++)
     {
-        generate_random_color(i);
-        set_ball_position(i);
+        RandomStream stream = random_stream(seed, (uint64_t)i * NUM_STREAMS + STREAM_VELOCITY);
+        stream.counter = 2;
+
+        const float size = floorf((float)scene->ball_size * expf(random_float(&stream) * spread) + 0.5f);
+        scene->balls.size[i] = fminf(fmaxf(size, (float)scene->ball_size), (float)scene->ball_size_max);
     }
 }
 
-void handle_collision(const int i, const int j)
+/*
+dart throwing for mixed sizes, biggest balls first, so the small ones fill the gaps between the big ones rather than
+the big ones looking for room between the small ones. the balls placed so far are kept in a linked list per slot of
+their size level, and a spot is tested against every level that has balls the way the broad phase searches them.
+*/
+void place_mixed_balls(Scene *scene, const uint64_t seed)
 {
-    if (!is_overlapping(&balls[i], &balls[j]))
-        return;
+    int *order = MALLOC((size_t)scene->num_balls * sizeof(int));
+    int *next = MALLOC((size_t)scene->num_balls * sizeof(int));
+    int *head = MALLOC((size_t)scene->grid_cells * sizeof(int));
+    int *size_start = MALLOC((size_t)(scene->ball_size_max - scene->ball_size + 2) * sizeof(int));
+    int placed[MAX_SIZE_LEVELS] = {0};
+
+    memset(head, 0xFF, (size_t)scene->grid_cells * sizeof(int));
+    memset(size_start, 0, (size_t)(scene->ball_size_max - scene->ball_size + 2) * sizeof(int));
 
-    Ball *ball_a = &balls[i];
-    Ball *ball_b = &balls[j];
+    // counting sort by size, biggest first and in index order within a size.
+    for (int i = 0; i < scene->num_balls; i++)
+        size_start[scene->ball_size_max - (int)scene->balls.size[i] + 1]++;
 
-    float dx = ball_a->x - ball_b->x;
-    float dy = ball_a->y - ball_b->y;
-    float dist = sqrtf(dx * dx + dy * dy);
+    for (int s = 0; s <= scene->ball_size_max - scene->ball_size; s++)
+        size_start[s + 1] += size_start[s];
 
-    // just in case the two circles are perfectly overlapping.
-    if (dist < 1e-6f)
+    for (int i = 0; i < scene->num_balls; i++)
+        order[size_start[scene->ball_size_max - (int)scene->balls.size[i]]++] = i;
+
+    for (int k = 0; k < scene->num_balls; k++)
     {
-        dx = 1.0f;
-        dy = 0.0f;
-        dist = 1.0f;
+        const int i = order[k];
+        const int level = size_level(scene, scene->balls.size[i]);
+        const float radius = scene->balls.size[i] * 0.5f;
+        const float span_x = (float)scene->world_width - scene->balls.size[i];
+        const float span_y = (float)scene->world_height - scene->balls.size[i];
+        RandomStream stream = random_stream(seed, (uint64_t)i * NUM_STREAMS + STREAM_POSITION);
+        bool is_free = false;
+
+        for (int dart = 0; dart < MIXED_PLACEMENT_DARTS && !is_free; dart++)
+        {
+            const float cx = random_float(&stream) * span_x + radius;
+            const float cy = random_float(&stream) * span_y + radius;
+            is_free = true;
+
+            for (int l = 0; l < scene->num_levels && is_free; l++)
+            {
+                if (!placed[l])
+                    continue;
+
+                int col0, col1, row0, row1;
+                level_span(scene, l, cx, radius, scene->level_cols[l], &col0, &col1);
+                level_span(scene, l, cy, radius, scene->level_rows[l], &row0, &row1);
+
+                for (int row = row0; row <= row1 && is_free; row++)
+                    for (int col = col0; col <= col1 && is_free; col++)
+                        for (int j = head[level_slot(scene, l, col, row)]; j >= 0 && is_free; j = next[j])
+                        {
+                            const float rj = scene->balls.size[j] * 0.5f;
+                            const float dx = cx - (scene->balls.x[j] + rj);
+                            const float dy = cy - (scene->balls.y[j] + rj);
+                            is_free = dx * dx + dy * dy >= (radius + rj) * (radius + rj) + EPSILON;
+                        }
+            }
+
+            if (is_free)
+            {
+                scene->balls.x[i] = cx - radius;
+                scene->balls.y[i] = cy - radius;
+
+                const int cell = level_cell_of(scene, level, cx, cy);
+                next[i] = head[cell];
+                head[cell] = i;
+                placed[level]++;
+            }
+        }
+
+        if (!is_free)
+            PERROR("Could only fit %d of %d balls of %d to %d px in a %dx%d world.",
+                k, scene->num_balls, scene->ball_size, scene->ball_size_max, scene->world_width, scene->world_height);
     }
 
-    const float nx = dx / dist;
-    const float ny = dy / dist;
+    free(order);
+    free(next);
+    free(head);
+    free(size_start);
+}
 
-    // --- Positional correction only ---
-    const float overlap = BALL_SIZE - dist;
-    const float separation = overlap / 2.0f;
+// bt.601 limited range, what ffmpeg assumes for yuv420p.
+uint32_t rgb_to_yuv(const uint32_t color)
+{
+    const int r = (int)(color >> 16 & 0xFF), g = (int)(color >> 8 & 0xFF), b = (int)(color & 0xFF);
+    const int y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    const int u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    const int v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    return (uint32_t)y << 16 | (uint32_t)u << 8 | (uint32_t)v;
+}
 
-    ball_a->x += nx * separation;
-    ball_a->y += ny * separation;
-    ball_b->x -= nx * separation;
-    ball_b->y -= ny * separation;
+// open addressing set of the colours in use. black is too dark to ever be picked, so 0 marks an empty slot.
+void pick_colours(Scene *scene, const uint64_t seed)
+{
+    uint32_t capacity = 1;
+    while (capacity < (uint32_t)scene->num_balls * 2)
+        capacity *= 2;
 
-    // --- Velocity bounce only if approaching ---
-    const float rvx = ball_a->vx - ball_b->vx;
-    const float rvy = ball_a->vy - ball_b->vy;
-    const float velAlongNormal = rvx * nx + rvy * ny;
+    uint32_t *used = MALLOC((size_t)capacity * sizeof(uint32_t));
+    memset(used, 0, (size_t)capacity * sizeof(uint32_t));
 
-    if (velAlongNormal < 0.0f)
+    for (int i = 0; i < scene->num_balls; i++)
     {
-        const float restitution = 1.0f;
-        const float impulse = -(1.0f + restitution) * velAlongNormal / 2.0f;
+        RandomStream stream = random_stream(seed, (uint64_t)i * NUM_STREAMS + STREAM_COLOUR);
+        int loop_count = 0;
+
+        MAKE_NEW_COLOR:
+
+        if (loop_count++ > 1<<16)
+            PERROR("Could not find a new colour for ball %d.", i);
 
-        const float impulseX = impulse * nx;
-        const float impulseY = impulse * ny;
+        const uint32_t color = (uint32_t)random_next(&stream) & 0xFFFFFF;
 
-        ball_a->vx += impulseX;
-        ball_a->vy += impulseY;
-        ball_b->vx -= impulseX;
-        ball_b->vy -= impulseY;
+        // too dark
+        if ((color >> 16) + (color >> 8 & 0xFF) + (color & 0xFF) < 150)
+            goto MAKE_NEW_COLOR;
+
+        // same color as the another ball.
+        uint32_t slot = (uint32_t)random_mix(color) & (capacity - 1);
+        for (; used[slot]; slot = (slot + 1) & (capacity - 1))
+            if (used[slot] == color)
+                goto MAKE_NEW_COLOR;
+
+        used[slot] = color;
+        scene->balls.color[i] = color;
+        scene->balls.yuv[i] = rgb_to_yuv(color);
     }
+
+    free(used);
 }
 
-void update_positions()
+// lays the slots of the size levels out for the balls each of them holds. a level gets a slot for every cell unless
+// that is more than twice its balls, then it is hashed into that many slots. at least 4 rows of them, so no two of
+// the 4x4 cells at most that a ball searches ever share a slot.
+void make_level_slots(Scene *scene)
 {
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < NUM_BALLS; i++)
+    scene->level_first[0] = 0;
+
+    for (int l = 0; l < scene->num_levels; l++)
     {
-        Ball *ball = &balls[i];
+        const int64_t cells = (int64_t)scene->level_cols[l] * (int64_t)scene->level_rows[l];
+        const int64_t slots = 2 * (int64_t)scene->level_balls[l] > 4 * (int64_t)scene->level_cols[l] ? 2 * (int64_t)scene->level_balls[l] : 4 * (int64_t)scene->level_cols[l];
 
-        ball->x += ball->vx;
-        ball->y += ball->vy;
+        scene->level_hashed[l] = cells > slots;
+        scene->level_slots[l] = (int)(scene->level_hashed[l] ? slots : cells);
+        scene->level_first[l + 1] = scene->level_first[l] + scene->level_slots[l];
+    }
 
-        if (ball->x < 0 || ball->x + BALL_SIZE > WIN_WIDTH)
-        {
-            ball->vx *= -1;
-            ball->x += ball->vx;
-        }
-        if (ball->y < 0 || ball->y + BALL_SIZE > WIN_HEIGHT)
+    scene->grid_cells = scene->level_first[scene->num_levels];
+
+    free(scene->cell_start);
+    free(scene->cell_fill);
+    scene->cell_start = MALLOC((size_t)(scene->grid_cells + 1) * sizeof(int));
+    scene->cell_fill = MALLOC((size_t)scene->grid_cells * sizeof(int));
+}
+
+// everything the physics needs that follows from the sizes: the mass of every ball and its size level.
+// the sizes are whole pixels.
+void apply_sizes(Scene *scene)
+{
+    memset(scene->level_balls, 0, sizeof(scene->level_balls));
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        scene->balls.mass[i] = scene->balls.size[i] * scene->balls.size[i];
+
+        if (scene->mixed_sizes)
         {
-            ball->vy *= -1;
-            ball->y += ball->vy;
+            scene->ball_level[i] = (uint8_t)size_level(scene, scene->balls.size[i]);
+            scene->level_balls[scene->ball_level[i]]++;
         }
     }
 
-    for (int i = 0; i < NUM_BALLS; i++)
-        for (int j = i + 1; j < NUM_BALLS; j++)
-            handle_collision(i, j);
+    if (scene->mixed_sizes)
+        make_level_slots(scene);
 }
 
-void setup_display()
+// the size every ball of the scene being drawn is drawn at through the camera.
+void apply_draw_sizes(const Scene *scene)
 {
-    display = XOpenDisplay(NULL);
+    free(draw_sizes);
+    draw_sizes = MALLOC((size_t)scene->num_balls * sizeof(int));
 
-    if (!display)
+    for (int i = 0; i < scene->num_balls; i++)
     {
-        PR("%s", "Cannot open display");
-        exit(EXIT_FAILURE);
+        const int drawn = (int)lroundf(scene->balls.size[i] * camera_zoom);
+        draw_sizes[i] = drawn < 2 ? 2 : drawn;
     }
+}
 
-    int screen = DefaultScreen(display);
-    Colormap colormap = DefaultColormap(display, screen);
-    XParseColor(display, colormap, "#1e1e1e", &vscode_gray);
-    XAllocColor(display, colormap, &vscode_gray);
+void make_balls(Scene *scene, const uint64_t seed)
+{
+    if (scene->mixed_sizes)
+    {
+        pick_sizes(scene, seed);
+        apply_sizes(scene);
+        place_mixed_balls(scene, seed);
+    }
+    else
+    {
+        for (int i = 0; i < scene->num_balls; i++)
+            scene->balls.size[i] = (float)scene->ball_size;
 
-    window = XCreateSimpleWindow(display, RootWindow(display, screen),
-                                        100, 100, WIN_WIDTH, WIN_HEIGHT, 1,
-                                        BlackPixel(display, screen), vscode_gray.pixel);
+        apply_sizes(scene);
+        place_balls(scene, seed);
+    }
 
-    XSelectInput(display, window, ExposureMask | KeyPressMask);
-    XMapWindow(display, window);
+    pick_colours(scene, seed);
 
-    gc = XCreateGC(display, window, 0, NULL);
+    #pragma omp parallel for schedule(static) if(scene->num_balls >= PARALLEL_MIN_BALLS)
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        RandomStream stream = random_stream(seed, (uint64_t)i * NUM_STREAMS + STREAM_VELOCITY);
+        scene->balls.vx[i] = (random_float(&stream) * 2.0f - 1.0f) * scene->max_speed;
+        scene->balls.vy[i] = (random_float(&stream) * 2.0f - 1.0f) * scene->max_speed;
+    }
 }
 
-int timer()
+// calls pair(i, j) with i < j for every pair of balls closer than sqrt(limit), for balls first..last-1.
+// limit can't be more than grid_cell_size squared, only the neighbouring cells are searched.
+// the 3 cells of a grid row are contiguous in cell order, so each row is tested a vector at a time.
+// tested(n) is called with the number of pairs in every vector tested.
+#define FOR_EACH_GRID_OVERLAP_IN(first, last, limit, pair, tested)\
+for (int i = first; i < last; i++)\
+{\
+    const int col = scene->ball_cell[i] % scene->grid_cols;\
+    const int row = scene->ball_cell[i] / scene->grid_cols;\
+    const int col0 = col > 0 ? col - 1 : col;\
+    const int col1 = col < scene->grid_cols - 1 ? col + 1 : col;\
+    const int row0 = row > 0 ? row - 1 : row;\
+    const int row1 = row < scene->grid_rows - 1 ? row + 1 : row;\
+\
+    for (int r = row0; r <= row1; r++)\
+    {\
+        const int row_end = scene->cell_start[r * scene->grid_cols + col1 + 1];\
+        for (int k = scene->cell_start[r * scene->grid_cols + col0]; k < row_end; k += SIMD_WIDTH)\
+        {\
+            const int n = row_end - k < SIMD_WIDTH ? row_end - k : SIMD_WIDTH;\
+            tested(n);\
+            uint32_t hits = overlap_mask(scene->balls.x[i], scene->balls.y[i], scene->cell_x + k, scene->cell_y + k, n, limit);\
+            while (hits)\
+            {\
+                const int j = scene->cell_balls[k + __builtin_ctz(hits)];\
+                hits &= hits - 1;\
+                if (j > i)\
+                    pair(i, j);\
+            }\
+        }\
+    }\
+}
+
+#ifdef VERIFY_BROAD_PHASE
+int compare_pairs(const void *a, const void *b)
+{
+    const uint64_t pa = *(const uint64_t *)a;
+    const uint64_t pb = *(const uint64_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+// all_pairs comes out of the all-pairs loop already sorted, grid_pairs is sorted here.
+// grid_pairs are the contacts the broad phase found, from the grid or the neighbour lists.
+void check_broad_phase(const uint64_t *all_pairs, const int num_all, uint64_t *grid_pairs, const int num_grid)
 {
-    // static double total_time = 0;
-    // static int frame_count = 0;
+    qsort(grid_pairs, (size_t)num_grid, sizeof(uint64_t), compare_pairs);
+
+    if (num_all != num_grid)
+        PERROR("Broad phase mismatch: all-pairs found %d overlaps, grid found %d.", num_all, num_grid);
+
+    for (int k = 0; k < num_all; k++)
+        if (all_pairs[k] != grid_pairs[k])
+            PERROR("Broad phase mismatch: pair (%d, %d) vs (%d, %d).",
+                (int)(all_pairs[k] >> 32), (int)(all_pairs[k] & 0xFFFFFFFF),
+                (int)(grid_pairs[k] >> 32), (int)(grid_pairs[k] & 0xFFFFFFFF));
+}
+#endif
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
+void reserve_contacts(ContactList *list, const int capacity)
+{
+    if (list->capacity >= capacity)
+        return;
 
-    // Always do the math, don't check start.tv_sec == 0 — it's always set
-    double elapsed =
-        (double)(end.tv_sec - start.tv_sec) * 1000.0 +
-        (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    list->capacity = capacity * 2;
+    list->contacts = realloc(list->contacts, (size_t)list->capacity * sizeof(Contact));
 
-    // total_time += elapsed;
-    // frame_count++;
+    if (!list->contacts)
+        PERROR("Could not grow the contact list to %d contacts.", list->capacity);
+}
 
-    // if (frame_count % (FPS * 2) == 0 && elapsed > 3)
-    // {
-    //     PR("Avg frame time: %.3f ms (%.1f FPS)", elapsed, 1000.0 / elapsed);
-    //     return 0;
-    // }
-    return (int) (elapsed * 1000 + 67);
+#define PUSH_CONTACT(list, i, j)\
+{\
+    if ((list)->count == (list)->capacity)\
+        reserve_contacts(list, (list)->count + 1);\
+    (list)->contacts[(list)->count++] = (Contact){i, j};\
 }
 
-bool close_on_key_press()
+// sorts the pairs of every ball of a list by partner. the grid finds the pairs of a ball together,
+// in the order of the cells their partners were in.
+void sort_partners(ContactList *list)
 {
-    while (XPending(display))
+    for (int run = 0, end; run < list->count; run = end)
     {
-        XEvent event;
-        XNextEvent(display, &event);
-        if (event.type == KeyPress)
+        const int a = list->contacts[run].a;
+        for (end = run + 1; end < list->count && list->contacts[end].a == a; end++)
         {
-            PR("%s", "Key pressed, exiting...");
-            return true;
+            const Contact pair = list->contacts[end];
+            int k = end;
+            for (; k > run && list->contacts[k - 1].b > pair.b; k--)
+                list->contacts[k] = list->contacts[k - 1];
+            list->contacts[k] = pair;
         }
     }
-    return false;
 }
 
-void pipe_to_ffmpeg()
+// one contact list per block of balls for find_pairs and filter_neighbours.
+void reserve_block_contacts(Scene *scene, const int num_blocks)
 {
+    if (scene->num_block_lists >= num_blocks)
+        return;
 
-    // --- 2. Manually draw into an RGB24 pixel buffer ---
-    static uint8_t rgb_buffer[WIN_WIDTH * WIN_HEIGHT * 3];
+    scene->block_contacts = realloc(scene->block_contacts, (size_t)num_blocks * sizeof(ContactList));
+    if (!scene->block_contacts)
+        PERROR("%s", "Could not allocate the per block contact lists.");
 
-    // Fill background with vscode gray: #1e1e1e (30,30,30)
-    memset(rgb_buffer, 30, sizeof(rgb_buffer));
+    memset(scene->block_contacts + scene->num_block_lists, 0, (size_t)(num_blocks - scene->num_block_lists) * sizeof(ContactList));
+    scene->num_block_lists = num_blocks;
+}
 
-    // --- 3. Draw circles into the buffer ---
-    for (int i = 0; i < NUM_BALLS; i++)
+// joins the per block lists into list in block order. called by every thread of a parallel region.
+void join_block_contacts(const Scene *scene, ContactList *list, const int num_blocks)
+{
+    #pragma omp single
     {
-        int cx = (int)(balls[i].x + BALL_SIZE / 2.0f);
-        int cy = (int)(balls[i].y + BALL_SIZE / 2.0f);
-        int radius = BALL_SIZE / 2;
-        int radius2 = radius * radius;
+        list->count = 0;
+        for (int block = 0; block < num_blocks; block++)
+            list->count += scene->block_contacts[block].count;
+        reserve_contacts(list, list->count);
+    }
 
-        // Extract color from X11 color (ARGB) to RGB
-        uint32_t color = (uint32_t)balls[i].color;
-        uint8_t r = (color >> 16) & 0xFF;
-        uint8_t g = (color >> 8) & 0xFF;
-        uint8_t b = color & 0xFF;
+    #pragma omp for schedule(static)
+    for (int block = 0; block < num_blocks; block++)
+    {
+        int offset = 0;
+        for (int k = 0; k < block; k++)
+            offset += scene->block_contacts[k].count;
 
-        for (int dy = -radius; dy <= radius; dy++) {
-            for (int dx = -radius; dx <= radius; dx++) {
-                if (dx * dx + dy * dy <= radius2) {
-                    int px = cx + dx;
-                    int py = cy + dy;
-                    if (px >= 0 && px < WIN_WIDTH && py >= 0 && py < WIN_HEIGHT) {
-                        int idx = (py * WIN_WIDTH + px) * 3;
-                        rgb_buffer[idx + 0] = r;
-                        rgb_buffer[idx + 1] = g;
-                        rgb_buffer[idx + 2] = b;
-                    }
-                }
-            }
-        }
+        memcpy(list->contacts + offset, scene->block_contacts[block].contacts, (size_t)scene->block_contacts[block].count * sizeof(Contact));
     }
-
-    // --- 4. Write frame to ffmpeg pipe ---
-    fwrite(rgb_buffer, 1, WIN_WIDTH * WIN_HEIGHT * 3, ffmpeg);
 }
 
-void stop_recording()
+// true when the neighbour lists have to be built again: some ball moved more than half the skin since they were,
+// so two balls that weren't neighbours then could be touching now.
+bool neighbours_stale(const Scene *scene)
 {
-    if (ffmpeg) {
-        fflush(ffmpeg);
-        pclose(ffmpeg);
-        ffmpeg = NULL;
-        printf("Recording stopped and file finalized.\n");
+    if (!scene->neighbours_built)
+        return true;
+
+    const float limit = (float)scene->neighbour_skin * (float)scene->neighbour_skin / 4.0f;
+    float worst = 0.0f;
+
+    #pragma omp parallel for schedule(static) reduction(max:worst) if(scene->num_balls >= PARALLEL_MIN_BALLS)
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        const float dx = scene->balls.x[i] - scene->built_x[i];
+        const float dy = scene->balls.y[i] - scene->built_y[i];
+        worst = fmaxf(worst, dx * dx + dy * dy);
     }
+
+    return worst > limit;
 }
 
-void draw_screen()
+// greedy colouring in contact order, so the batches only depend on the contact list.
+void colour_contacts(Scene *scene)
 {
-    #ifdef SHOW
-    XClearWindow(display, window);
-    for (int i = 0; i < NUM_BALLS; i++)
+    if (scene->contact_colour_capacity < scene->found_contacts.count)
     {
-        XSetForeground(display, gc, balls[i].color);
-        XFillArc(display, window, gc,
-                    (int)balls[i].x, (int)balls[i].y,
-                    BALL_SIZE, BALL_SIZE, 0, 360 * 64);
+        scene->contact_colour_capacity = scene->found_contacts.count * 2;
+        free(scene->contact_colour);
+        scene->contact_colour = MALLOC((size_t)scene->contact_colour_capacity);
     }
-    XFlush(display);
-    #endif
 
-    #ifdef RENDER
-    pipe_to_ffmpeg();
-    #endif
+    memset(scene->ball_colours, 0, (size_t)scene->num_balls * sizeof(uint64_t));
+    memset(scene->colour_start, 0, sizeof(scene->colour_start));
+
+    for (int k = 0; k < scene->found_contacts.count; k++)
+    {
+        const Contact c = scene->found_contacts.contacts[k];
+        const uint64_t used = scene->ball_colours[c.a] | scene->ball_colours[c.b];
+        const int colour = ~used ? __builtin_ctzll(~used) : MAX_COLOURS;
+
+        if (colour < MAX_COLOURS)
+        {
+            scene->ball_colours[c.a] |= 1ull << colour;
+            scene->ball_colours[c.b] |= 1ull << colour;
+        }
+
+        scene->contact_colour[k] = (uint8_t)colour;
+        scene->colour_start[colour + 1]++;
+    }
+
+    for (int c = 0; c <= MAX_COLOURS; c++)
+        scene->colour_start[c + 1] += scene->colour_start[c];
+
+    reserve_contacts(&scene->coloured_contacts, scene->found_contacts.count);
+    scene->coloured_contacts.count = scene->found_contacts.count;
+
+    int colour_fill[MAX_COLOURS + 1];
+    memcpy(colour_fill, scene->colour_start, sizeof(colour_fill));
+
+    for (int k = 0; k < scene->found_contacts.count; k++)
+        scene->coloured_contacts.contacts[colour_fill[scene->contact_colour[k]]++] = scene->found_contacts.contacts[k];
+}
+
+// one copy of the physics per common ball size, and one for any other size.
+#define KERNEL_SUFFIX 20
+#define KERNEL_BALL_SIZE 20
+#include "physics_kernels.h"
+
+#define KERNEL_SUFFIX 40
+#define KERNEL_BALL_SIZE 40
+#include "physics_kernels.h"
+
+#define KERNEL_SUFFIX 80
+#define KERNEL_BALL_SIZE 80
+#include "physics_kernels.h"
+
+#define KERNEL_SUFFIX any
+#define KERNEL_BALL_SIZE scene->ball_size
+#include "physics_kernels.h"
+
+// and one for balls of mixed sizes, on the level grid.
+#include "mixed_kernels.h"
+
+#define KERNEL_SUFFIX mixed
+#define KERNEL_MIXED_SIZES
+#include "physics_kernels.h"
+
+const PhysicsKernels physics_kernels[] = {
+    {20, integrate_balls_20, broad_phase_20, narrow_phase_20},
+    {40, integrate_balls_40, broad_phase_40, narrow_phase_40},
+    {80, integrate_balls_80, broad_phase_80, narrow_phase_80},
+    {0, integrate_balls_any, broad_phase_any, narrow_phase_any},
+};
+
+const PhysicsKernels mixed_physics = {0, integrate_balls_mixed, broad_phase_mixed, narrow_phase_mixed};
+
+// picks the first physics compiled for the ball size of the scene, the last entry matches anything.
+// mixed sizes have physics of their own.
+const PhysicsKernels *select_physics(const Scene *scene)
+{
+    if (scene->ball_size_max > scene->ball_size)
+        return &mixed_physics;
+
+    size_t k = 0;
+    while (physics_kernels[k].ball_size && physics_kernels[k].ball_size != scene->ball_size)
+        k++;
+
+    return &physics_kernels[k];
+}
+
+// where every ball is at the engine's time, for drawing and checkpoints.
+void event_positions(Scene *scene)
+{
+    #pragma omp parallel for schedule(static) if(scene->num_balls >= PARALLEL_MIN_BALLS)
+    for (int i = 0; i < scene->num_balls; i++)
+        events_position(&scene->events, i, &scene->balls.x[i], &scene->balls.y[i], &scene->balls.vx[i], &scene->balls.vy[i]);
 }
 
-void simulate()
+// runs the event driven engine to the end of the frame.
+void advance_events(Scene *scene)
 {
-    uint32_t num_frames = 0;
+    events_advance(&scene->events, scene->events.now + 1.0);
 
-    LOOP:
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    STAT_COUNT(COUNT_EVENTS, scene->events.frame.events);
+    STAT_COUNT(COUNT_PAIR_TESTS, scene->events.frame.pair_tests);
+    STAT_COUNT(COUNT_IMPULSES, scene->events.frame.collisions);
+    STAT_COUNT(COUNT_WALL_BOUNCES, scene->events.frame.bounces);
+}
 
-    #ifdef SHOW
-    if (close_on_key_press())
+void update_positions(Scene *scene)
+{
+    if (scene->event_driven)
+    {
+        advance_events(scene);
+        STAT_END_PHASE(STATS_EVENTS)
+        event_positions(scene);
+        STAT_END_PHASE(STATS_INTEGRATE)
         return;
-    #endif
+    }
+
+    scene->physics->integrate_balls(scene);
+    STAT_END_PHASE(STATS_INTEGRATE)
+    scene->physics->broad_phase(scene);
+    STAT_END_PHASE(STATS_BROAD)
+    scene->physics->narrow_phase(scene);
+    STAT_END_PHASE(STATS_NARROW)
+}
+
+// fills count pixels with one colour. pattern holds the colour 16 times, so most of a span is a few 16 byte stores.
+static inline void fill_rgb_span(uint8_t *dst, int count, const uint8_t pattern[48])
+{
+    for (; count >= 16; count -= 16, dst += 48)
+        memcpy(dst, pattern, 48);
 
-    update_positions();
-    draw_screen();
+    memcpy(dst, pattern, (size_t)count * 3);
+}
 
-    const int delay  = (1000000 / FPS) - timer();
-    if (delay > 0) usleep((__useconds_t)delay); 
-    timer();
+// loops over the tiles that box touches, in a frame tile_cols tiles wide.
+#define FOR_EACH_TILE_IN(box, tile_cols, t)\
+for (int ty_ = (box).y0 / TILE_HEIGHT; ty_ <= ((box).y1 - 1) / TILE_HEIGHT; ty_++)\
+    for (int tx_ = (box).x0 / TILE_WIDTH, t = ty_ * (tile_cols) + tx_; tx_ <= ((box).x1 - 1) / TILE_WIDTH; tx_++, t++)
+
+// one copy of the rasterizer per common ball size and resolution, and one for anything else.
+#define KERNEL_SUFFIX 20_1920x1080
+#define KERNEL_BALL_SIZE 20
+#define KERNEL_FRAME_WIDTH 1920
+#define KERNEL_FRAME_HEIGHT 1080
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX 40_1920x1080
+#define KERNEL_BALL_SIZE 40
+#define KERNEL_FRAME_WIDTH 1920
+#define KERNEL_FRAME_HEIGHT 1080
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX 80_1920x1080
+#define KERNEL_BALL_SIZE 80
+#define KERNEL_FRAME_WIDTH 1920
+#define KERNEL_FRAME_HEIGHT 1080
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX 20_3840x2160
+#define KERNEL_BALL_SIZE 20
+#define KERNEL_FRAME_WIDTH 3840
+#define KERNEL_FRAME_HEIGHT 2160
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX 40_3840x2160
+#define KERNEL_BALL_SIZE 40
+#define KERNEL_FRAME_WIDTH 3840
+#define KERNEL_FRAME_HEIGHT 2160
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX 80_3840x2160
+#define KERNEL_BALL_SIZE 80
+#define KERNEL_FRAME_WIDTH 3840
+#define KERNEL_FRAME_HEIGHT 2160
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX any
+#define KERNEL_BALL_SIZE draw_size
+#define KERNEL_FRAME_WIDTH frame_width
+#define KERNEL_FRAME_HEIGHT frame_height
+#include "render_kernels.h"
+
+#define KERNEL_SUFFIX mixed
+#define KERNEL_MIXED_SIZES
+#define KERNEL_FRAME_WIDTH frame_width
+#define KERNEL_FRAME_HEIGHT frame_height
+#include "render_kernels.h"
 
-    if (++num_frames > NUM_FRAMES)
+typedef struct
+{
+    int draw_size, frame_width, frame_height; // 0 matches anything
+    uint64_t (*render_frame)(Canvas *canvas, const Shown *shown);
+    uint64_t (*render_dirty)(Canvas *canvas, const Shown *shown);
+} RenderKernels;
+
+const RenderKernels render_kernels[] = {
+    {20, 1920, 1080, render_frame_20_1920x1080, render_dirty_20_1920x1080},
+    {40, 1920, 1080, render_frame_40_1920x1080, render_dirty_40_1920x1080},
+    {80, 1920, 1080, render_frame_80_1920x1080, render_dirty_80_1920x1080},
+    {20, 3840, 2160, render_frame_20_3840x2160, render_dirty_20_3840x2160},
+    {40, 3840, 2160, render_frame_40_3840x2160, render_dirty_40_3840x2160},
+    {80, 3840, 2160, render_frame_80_3840x2160, render_dirty_80_3840x2160},
+    {0, 0, 0, render_frame_any, render_dirty_any},
+};
+
+const RenderKernels mixed_renderer = {0, 0, 0, render_frame_mixed, render_dirty_mixed};
+
+RenderKernels renderer;
+
+// picks the first rasterizer compiled for the size the balls are drawn at and the frame. the last entry of the
+// table matches anything. mixed sizes have a rasterizer of their own.
+void select_kernels()
+{
+    if (mixed_sizes)
+    {
+        renderer = mixed_renderer;
         return;
+    }
 
-    goto LOOP;
+    for (size_t k = 0; k < sizeof(render_kernels) / sizeof(render_kernels[0]); k++)
+        if (render_kernels[k].draw_size == 0 ||
+            (render_kernels[k].draw_size == draw_size &&
+             render_kernels[k].frame_width == frame_width &&
+             render_kernels[k].frame_height == frame_height))
+        {
+            renderer = render_kernels[k];
+            break;
+        }
 }
 
-int main()
+// the half widths of the 2 * radius + 1 rows of a ball, see ball_spans.
+void fill_spans(int *spans, const int radius)
 {
-    #ifdef RENDER
-    char *fname = "out.mp4";///home/pi/Documents/Youtube/Balls/Frames/out.mp4";
-    char command[256];
-    sprintf(command, "ffmpeg -y -f rawvideo -pixel_format rgb24 -video_size %dx%d -framerate 60 "
-        "-i - -vf format=yuv420p -c:v libx264 -preset fast %s", WIN_WIDTH, WIN_HEIGHT, fname);
-    ffmpeg = popen(command, "w");
-    #endif
+    for (int dy = -radius; dy <= radius; dy++)
+    {
+        int half_width = (int)sqrtf((float)(radius * radius - dy * dy));
 
+        // sqrtf can land one off either side of the exact integer root.
+        while (half_width * half_width > radius * radius - dy * dy) half_width--;
+        while ((half_width + 1) * (half_width + 1) <= radius * radius - dy * dy) half_width++;
+
+        spans[dy + radius] = half_width;
+    }
+}
 
-    #ifdef SHOW
-    setup_display();
-    #endif
+void make_ball_spans()
+{
+    const int radius = draw_size / 2;
 
+    free(ball_spans);
+    ball_spans = MALLOC((size_t)(2 * radius + 1) * sizeof(int));
+    fill_spans(ball_spans, radius);
 
-    make_balls();
-    simulate();
+    free(radius_spans);
+    free(radius_start);
+    radius_spans = radius_start = NULL;
 
-    #ifdef SHOW
-    XFreeGC(display, gc);
-    XCloseDisplay(display);
-    #endif
+    if (!mixed_sizes)
+        return;
 
-    #ifdef RENDER
-    stop_recording();
-    #endif
+    const int max_radius = (draw_size_max > 2 ? draw_size_max : 2) / 2;
+    radius_start = MALLOC((size_t)(max_radius + 2) * sizeof(int));
 
-    exit(EXIT_SUCCESS);
+    radius_start[0] = 0;
+    for (int r = 0; r <= max_radius; r++)
+        radius_start[r + 1] = radius_start[r] + 2 * r + 1;
+
+    radius_spans = MALLOC((size_t)radius_start[max_radius + 1] * sizeof(int));
+    for (int r = 0; r <= max_radius; r++)
+        fill_spans(radius_spans + radius_start[r], r);
+}
+
+// everything that follows from the settings: derived sizes, span table and kernels.
+void apply_settings()
+{
+    num_tiles = ((frame_width + TILE_WIDTH - 1) / TILE_WIDTH) * ((frame_height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+    frame_bytes = (size_t)frame_width * (size_t)frame_height * (yuv420 ? 3 : 6) / 2;
+    background_yuv = rgb_to_yuv(0x1e1e1e);
+    mixed_sizes = ball_size_max > ball_size;
+
+    if (camera_zoom <= 0.0f)
+        camera_zoom = 1.0f;
+
+    draw_size = (int)lroundf((float)ball_size * camera_zoom);
+    draw_size = draw_size < 2 ? 2 : draw_size;
+    draw_size_max = (int)lroundf((float)ball_size_max * camera_zoom);
+
+    make_ball_spans();
+    select_kernels();
 }
 
+// pins the threads of the calling thread's omp team to a cpu each, out of the ones this process may run on, thread t
+// to the (first + t)-th of them, so every phase finds the team where the last one left it. omp keeps the same threads
+// from one parallel region to the next. the physics team leaves the main thread alone, the pipeline and checkpoint
+// threads it starts later take its affinity. the drawing stage's team has cpus of its own and pins its caller too.
+void pin_team(const char *name, const int first, const bool with_caller)
+{
+    cpu_set_t allowed;
+    if (getenv("OMP_PROC_BIND") || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    int cpus[CPU_SETSIZE];
+    int num_cpus = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET((size_t)c, &allowed))
+            cpus[num_cpus++] = c;
 
+    if (num_cpus < 2)
+        return;
+
+    int pinned = 0;
+
+    #pragma omp parallel reduction(+:pinned)
+    {
+        const int t = omp_get_thread_num();
+
+        if (t || with_caller)
+        {
+            cpu_set_t cpu;
+            CPU_ZERO(&cpu);
+            CPU_SET((size_t)cpus[(first + t) % num_cpus], &cpu);
+            pinned += pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) == 0;
+        }
+    }
+
+    printf("Pinned %d %s threads to their own cpus.\n", pinned, name);
+}
+
+// the pipeline draws with an omp team of its own while the physics team steps the next frame. the two split the
+// threads omp would give one team, so they don't take turns on the same cpus.
+void split_team()
+{
+    const int threads = omp_get_max_threads();
+
+    draw_threads = threads / 2 > 1 ? threads / 2 : 1;
+    physics_threads = threads - draw_threads > 1 ? threads - draw_threads : 1;
+    omp_set_num_threads(physics_threads);
+}
+
+// a new scene with the settings as they are now, from the command line, a checkpoint, a trajectory or a batch line.
+void scene_settings(Scene *scene)
+{
+    *scene = (Scene){
+        .world_width = world_width,
+        .world_height = world_height,
+        .num_balls = num_balls,
+        .ball_size = ball_size,
+        .ball_size_max = ball_size_max,
+        .fps = fps,
+        .seed = scene_seed,
+        .neighbour_skin = neighbour_skin,
+        .event_driven = event_driven,
+    };
+}
+
+// everything that follows from the settings of the scene: its physics and everything sized by the ball count or
+// the world.
+void alloc_scene(Scene *scene)
+{
+    scene->mixed_sizes = scene->ball_size_max > scene->ball_size;
+    scene->max_speed = (float)BASE_SPEED * 60.0f / (float)scene->fps;
+    scene->physics = select_physics(scene);
+
+    const size_t padded = (size_t)SIMD_PAD(scene->num_balls);
+
+    scene->balls.x = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+    scene->balls.y = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+    scene->balls.vx = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+    scene->balls.vy = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+    scene->balls.color = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(uint32_t));
+    scene->balls.yuv = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(uint32_t));
+    scene->balls.size = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+    scene->balls.mass = ALIGNED_MALLOC(SIMD_ALIGN, padded * sizeof(float));
+
+    memset(scene->balls.x, 0, padded * sizeof(float));
+    memset(scene->balls.y, 0, padded * sizeof(float));
+    memset(scene->balls.vx, 0, padded * sizeof(float));
+    memset(scene->balls.vy, 0, padded * sizeof(float));
+    memset(scene->balls.color, 0, padded * sizeof(uint32_t));
+    memset(scene->balls.yuv, 0, padded * sizeof(uint32_t));
+    memset(scene->balls.size, 0, padded * sizeof(float));
+    memset(scene->balls.mass, 0, padded * sizeof(float));
+
+    scene->grid_cell_size = scene->ball_size + scene->neighbour_skin;
+    scene->grid_cols = scene->world_width / scene->grid_cell_size + 1;
+    scene->grid_rows = scene->world_height / scene->grid_cell_size + 1;
+    scene->grid_cells = scene->grid_cols * scene->grid_rows;
+
+    // the levels of mixed sizes take the place of the grid. their slots are only known once the sizes are, see apply_sizes.
+    if (scene->mixed_sizes)
+    {
+        scene->num_levels = 1;
+        while (scene->num_levels < MAX_SIZE_LEVELS && (scene->ball_size << (scene->num_levels - 1)) < scene->ball_size_max)
+            scene->num_levels++;
+
+        for (int l = 0; l < scene->num_levels; l++)
+        {
+            scene->level_cell[l] = scene->ball_size << l;
+            scene->level_cols[l] = scene->world_width / scene->level_cell[l] + 1;
+            scene->level_rows[l] = scene->world_height / scene->level_cell[l] + 1;
+        }
+
+        scene->cell_start = scene->cell_fill = NULL;
+    }
+    else
+    {
+        scene->cell_start = MALLOC((size_t)(scene->grid_cells + 1) * sizeof(int));
+        scene->cell_fill = MALLOC((size_t)scene->grid_cells * sizeof(int));
+    }
+
+    scene->cell_balls = MALLOC((size_t)scene->num_balls * sizeof(int));
+    scene->ball_cell = MALLOC((size_t)scene->num_balls * sizeof(int));
+    scene->cell_x = MALLOC((size_t)scene->num_balls * sizeof(float));
+    scene->cell_y = MALLOC((size_t)scene->num_balls * sizeof(float));
+    scene->cell_r = MALLOC((size_t)scene->num_balls * sizeof(float));
+    scene->ball_level = MALLOC((size_t)scene->num_balls);
+    scene->ball_colours = MALLOC((size_t)scene->num_balls * sizeof(uint64_t));
+    scene->built_x = MALLOC((size_t)scene->num_balls * sizeof(float));
+    scene->built_y = MALLOC((size_t)scene->num_balls * sizeof(float));
+    scene->neighbours_built = false;
+}
+
+void free_scene(Scene *scene)
+{
+    free(scene->balls.x);
+    free(scene->balls.y);
+    free(scene->balls.vx);
+    free(scene->balls.vy);
+    free(scene->balls.color);
+    free(scene->balls.yuv);
+    free(scene->balls.size);
+    free(scene->balls.mass);
+    free(scene->cell_start);
+    free(scene->cell_fill);
+    free(scene->cell_balls);
+    free(scene->ball_cell);
+    free(scene->cell_x);
+    free(scene->cell_y);
+    free(scene->cell_r);
+    free(scene->ball_level);
+    free(scene->ball_colours);
+    free(scene->built_x);
+    free(scene->built_y);
+    free(scene->contact_colour);
+    free(scene->found_contacts.contacts);
+    free(scene->coloured_contacts.contacts);
+    free(scene->neighbour_pairs.contacts);
+
+    for (int block = 0; block < scene->num_block_lists; block++)
+        free(scene->block_contacts[block].contacts);
+
+    free(scene->block_contacts);
+}
+
+void setup_display()
+{
+    // the encoding stage of the pipeline shows frames while the main thread looks for key presses.
+    XInitThreads();
+    display = XOpenDisplay(NULL);
+
+    if (!display)
+    {
+        PR("%s", "Cannot open display");
+        exit(EXIT_FAILURE);
+    }
+
+    int screen = DefaultScreen(display);
+    Colormap colormap = DefaultColormap(display, screen);
+    XParseColor(display, colormap, "#1e1e1e", &vscode_gray);
+    XAllocColor(display, colormap, &vscode_gray);
+
+    window = XCreateSimpleWindow(display, RootWindow(display, screen),
+                                        100, 100, (unsigned int)frame_width, (unsigned int)frame_height, 1,
+                                        BlackPixel(display, screen), vscode_gray.pixel);
+
+    // every frame repaints the whole window, so there's nothing to do on expose.
+    XSelectInput(display, window, KeyPressMask);
+    XMapWindow(display, window);
+
+    gc = XCreateGC(display, window, 0, NULL);
+
+    Visual *visual = DefaultVisual(display, screen);
+    if (DefaultDepth(display, screen) != 24 || visual->red_mask != 0xFF0000 || visual->green_mask != 0xFF00 || visual->blue_mask != 0xFF)
+        PERROR("%s", "The window needs a 24 bit rgb visual.");
+
+    window_uses_shm = XShmQueryExtension(display);
+    shm_completion = XShmGetEventBase(display) + ShmCompletion;
+
+    for (int b = 0; b < 2; b++)
+    {
+        XImage *image;
+
+        if (window_uses_shm)
+        {
+            image = XShmCreateImage(display, visual, 24, ZPixmap, NULL, &window_shm[b],
+                                    (unsigned int)frame_width, (unsigned int)frame_height);
+            if (!image)
+                PERROR("%s", "Could not create a shared memory image.");
+
+            window_shm[b].shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * (size_t)image->height, IPC_CREAT | 0600);
+            if (window_shm[b].shmid < 0)
+                PERROR("Could not create a shared memory segment: %s", strerror(errno));
+
+            window_shm[b].shmaddr = image->data = shmat(window_shm[b].shmid, NULL, 0);
+            if (window_shm[b].shmaddr == (char *)-1)
+                PERROR("Could not attach a shared memory segment: %s", strerror(errno));
+
+            window_shm[b].readOnly = False;
+            XShmAttach(display, &window_shm[b]);
+            XSync(display, False);
+
+            // the segment goes away once both sides detached, even if we crash.
+            shmctl(window_shm[b].shmid, IPC_RMID, NULL);
+        }
+        else
+        {
+            image = XCreateImage(display, visual, 24, ZPixmap, 0, MALLOC((size_t)frame_width * (size_t)frame_height * 4),
+                                 (unsigned int)frame_width, (unsigned int)frame_height, 32, 0);
+            if (!image)
+                PERROR("%s", "Could not create an image.");
+        }
+
+        if (image->bits_per_pixel != 32 || image->byte_order != LSBFirst)
+            PERROR("%s", "The window needs 32 bit little endian pixels.");
+
+        window_images[b] = image;
+    }
+}
+
+void close_display()
+{
+    // the x server may still be reading the images.
+    XSync(display, False);
+
+    for (int b = 0; b < 2; b++)
+    {
+        if (window_uses_shm)
+        {
+            XShmDetach(display, &window_shm[b]);
+            XDestroyImage(window_images[b]);
+            shmdt(window_shm[b].shmaddr);
+        }
+        else
+            XDestroyImage(window_images[b]);
+    }
+
+    XFreeGC(display, gc);
+    XCloseDisplay(display);
+}
+
+// only takes key presses off the queue, the shm completion events are for show_frame.
+bool close_on_key_press()
+{
+    XEvent event;
+    if (XCheckTypedEvent(display, KeyPress, &event))
+    {
+        PR("%s", "Key pressed, exiting...");
+        return true;
+    }
+    return false;
+}
+
+Canvas make_canvas()
+{
+    return (Canvas){
+        .pixels = ALIGNED_MALLOC(encoder_page_size(), frame_bytes),
+        .drawn_balls = MALLOC((size_t)num_balls * sizeof(int)),
+        .drawn_x = MALLOC((size_t)num_balls * sizeof(int)),
+        .drawn_y = MALLOC((size_t)num_balls * sizeof(int)),
+        .drawn = false,
+        .bins = {
+            .tile_start = MALLOC((size_t)(num_tiles + 1) * sizeof(int)),
+            .tile_fill = MALLOC((size_t)num_tiles * sizeof(int)),
+            .dirty_start = MALLOC((size_t)(num_tiles + 1) * sizeof(int)),
+            .dirty_fill = MALLOC((size_t)num_tiles * sizeof(int)),
+        },
+    };
+}
+
+void free_canvas(Canvas *canvas)
+{
+    free(canvas->pixels);
+    free(canvas->drawn_balls);
+    free(canvas->drawn_x);
+    free(canvas->drawn_y);
+    free(canvas->bins.tile_start);
+    free(canvas->bins.tile_fill);
+    free(canvas->bins.tile_balls);
+    free(canvas->bins.dirty_start);
+    free(canvas->bins.dirty_fill);
+    free(canvas->bins.dirty_boxes);
+}
+
+// a Shown with room for every ball.
+Shown make_shown()
+{
+    return (Shown){
+        .balls = MALLOC((size_t)num_balls * sizeof(int)),
+        .x = MALLOC((size_t)num_balls * sizeof(float)),
+        .y = MALLOC((size_t)num_balls * sizeof(float)),
+    };
+}
+
+void free_shown(Shown *shown)
+{
+    free(shown->balls);
+    free(shown->x);
+    free(shown->y);
+}
+
+// where the camera is along one axis on frame: start plus pan a second, going back and forth over the room between
+// the edges of the world. at 0 when there's no room, the frame shows all of the world that way.
+static inline float camera_axis(const double start, const double pan, const uint64_t frame, const double room)
+{
+    if (room <= 0.0)
+        return 0.0f;
+
+    double at = fmod(start + pan * (double)frame / (double)fps, 2.0 * room);
+    if (at < 0.0)
+        at += 2.0 * room;
+
+    return (float)(at > room ? 2.0 * room - at : at);
+}
+
+// where the camera is on frame. it only depends on the frame number, so a resumed run films the same video.
+Camera camera_at(const uint64_t frame)
+{
+    return (Camera){
+        camera_axis(camera_x, pan_x, frame, (double)world_width - (double)frame_width / camera_zoom),
+        camera_axis(camera_y, pan_y, frame, (double)world_height - (double)frame_height / camera_zoom),
+        camera_zoom,
+    };
+}
+
+// true when camera shows all of the world.
+static inline bool shows_world(const Camera camera)
+{
+    return camera.x <= 0.0f && camera.y <= 0.0f &&
+        (float)world_width * camera.zoom <= (float)frame_width && (float)world_height * camera.zoom <= (float)frame_height;
+}
+
+// adds ball i, with its top left corner at xs[i], ys[i] in the world, to shown if it can touch the frame.
+static inline void show_ball(Shown *shown, const float *xs, const float *ys, const int i, const Camera camera)
+{
+    const float x = (xs[i] - camera.x) * camera.zoom;
+    const float y = (ys[i] - camera.y) * camera.zoom;
+    const float size = (float)(mixed_sizes ? draw_sizes[i] : draw_size);
+
+    // a pixel to spare either way for the rounding of where the ball is centred.
+    if (x + size + 1.0f < 0.0f || y + size + 1.0f < 0.0f || x - 1.0f >= (float)frame_width || y - 1.0f >= (float)frame_height)
+        return;
+
+    shown->balls[shown->count] = i;
+    shown->x[shown->count] = x;
+    shown->y[shown->count] = y;
+    shown->count++;
+}
+
+// the balls at xs, ys that camera shows, testing every one of them. when it shows all of the world they all go in
+// untested, at 0, 0 and without a zoom that leaves the positions exactly as they are.
+void show_all(Shown *shown, const float *xs, const float *ys, const Camera camera)
+{
+    shown->count = 0;
+
+    if (!shows_world(camera))
+    {
+        for (int i = 0; i < num_balls; i++)
+            show_ball(shown, xs, ys, i, camera);
+        return;
+    }
+
+    for (int i = 0; i < num_balls; i++)
+    {
+        shown->balls[i] = i;
+        shown->x[i] = (xs[i] - camera.x) * camera.zoom;
+        shown->y[i] = (ys[i] - camera.y) * camera.zoom;
+    }
+
+    shown->count = num_balls;
+}
+
+// adds the balls of the cells of one grid that camera can see to shown->balls, unsorted and untested. the grid is
+// cols x rows cells of cell pixels in slots first .. first + slots, wrapped around them when hashed, see level_slot.
+// its balls can have moved since it was built, by less than a cell, and are binned by their corner or their centre,
+// so two cells around the view are taken as well.
+void show_cells(Shown *shown, const Scene *scene, const int first, const int slots, const bool hashed, const int cols, const int rows,
+                const float cell, const Camera camera)
+{
+    const float x0 = camera.x - 2.0f * cell, x1 = camera.x + (float)frame_width / camera.zoom + 2.0f * cell;
+    const float y0 = camera.y - 2.0f * cell, y1 = camera.y + (float)frame_height / camera.zoom + 2.0f * cell;
+
+    const int col0 = x0 <= 0.0f ? 0 : (int)(x0 / cell) < cols ? (int)(x0 / cell) : cols - 1;
+    const int col1 = x1 <= 0.0f ? 0 : (int)(x1 / cell) < cols ? (int)(x1 / cell) : cols - 1;
+    const int row0 = y0 <= 0.0f ? 0 : (int)(y0 / cell) < rows ? (int)(y0 / cell) : rows - 1;
+    const int row1 = y1 <= 0.0f ? 0 : (int)(y1 / cell) < rows ? (int)(y1 / cell) : rows - 1;
+
+    // past a table's worth of cells the rows of a hashed grid come round onto slots already taken, take them all once.
+    if (hashed && (int64_t)(row1 - row0 + 1) * cols >= slots)
+    {
+        for (int k = scene->cell_start[first]; k < scene->cell_start[first + slots]; k++)
+            shown->balls[shown->count++] = scene->cell_balls[k];
+        return;
+    }
+
+    for (int row = row0; row <= row1; row++)
+    {
+        const int64_t cell0 = (int64_t)row * cols + col0;
+        const int slot0 = first + (int)(hashed ? cell0 % slots : cell0);
+        const int slot1 = slot0 + (col1 - col0) < first + slots ? slot0 + (col1 - col0) : slot0 + (col1 - col0) - slots;
+        const int runs[2][2] = {
+            {slot0, slot0 <= slot1 ? slot1 : first + slots - 1},
+            {first, slot0 <= slot1 ? first - 1 : slot1},
+        };
+
+        for (int run = 0; run < 2; run++)
+            for (int k = scene->cell_start[runs[run][0]]; k < scene->cell_start[runs[run][1] + 1]; k++)
+                shown->balls[shown->count++] = scene->cell_balls[k];
+    }
+}
+
+int compare_ints(const void *a, const void *b)
+{
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+// the balls the frame shows with camera, from the physics thread. the grid the broad phase built last narrows them
+// down to the cells in view, so past the cells the cost goes with what is on the frame and not with the world.
+// event driven runs have no such grid and test every ball, they have just worked out where every one is anyway.
+void show_scene(Shown *shown, const Scene *scene, const Camera camera)
+{
+    if (shows_world(camera) || scene->event_driven)
+    {
+        show_all(shown, scene->balls.x, scene->balls.y, camera);
+        return;
+    }
+
+    shown->count = 0;
+
+    if (scene->mixed_sizes)
+    {
+        for (int l = 0; l < scene->num_levels; l++)
+            if (scene->level_balls[l])
+                show_cells(shown, scene, scene->level_first[l], scene->level_slots[l], scene->level_hashed[l], scene->level_cols[l], scene->level_rows[l], (float)scene->level_cell[l], camera);
+    }
+    else
+        show_cells(shown, scene, 0, scene->grid_cells, false, scene->grid_cols, scene->grid_rows, (float)scene->grid_cell_size, camera);
+
+    // back into index order, then down to the ones that really touch the frame. the list is tested in place, it
+    // only ever gets shorter.
+    const int candidates = shown->count;
+    qsort(shown->balls, (size_t)candidates, sizeof(int), compare_ints);
+    shown->count = 0;
+
+    for (int c = 0; c < candidates; c++)
+        show_ball(shown, scene->balls.x, scene->balls.y, shown->balls[c], camera);
+}
+
+// draws the shown balls into canvas, redrawing only what moved when dirty_regions is on.
+void draw_frame(Canvas *canvas, const Shown *shown)
+{
+    const uint64_t bytes = dirty_regions ? renderer.render_dirty(canvas, shown) : renderer.render_frame(canvas, shown);
+
+    bytes_touched += bytes;
+    frames_drawn++;
+    STAT_COUNT_IN(&main_scene, COUNT_DRAWN_BYTES, bytes);
+}
+
+static inline uint32_t clamp_byte(const int value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : (uint32_t)value;
+}
+
+// converts a drawn frame to the 32 bit xrgb pixels of the window. rows of the image are stride pixels apart.
+void frame_to_xrgb(uint32_t *xrgb, const size_t stride, const uint8_t *pixels)
+{
+    const size_t width = (size_t)frame_width;
+
+    const bool parallel = (int64_t)frame_width * frame_height >= PARALLEL_MIN_PIXELS;
+
+    if (!yuv420)
+    {
+        #pragma omp parallel for schedule(static) if(parallel)
+        for (int py = 0; py < frame_height; py++)
+        {
+            const uint8_t *rgb = pixels + (size_t)py * width * 3;
+            uint32_t *row = xrgb + (size_t)py * stride;
+
+            for (size_t px = 0; px < width; px++)
+                row[px] = (uint32_t)rgb[3 * px] << 16 | (uint32_t)rgb[3 * px + 1] << 8 | (uint32_t)rgb[3 * px + 2];
+        }
+        return;
+    }
+
+    const uint8_t *u_plane = pixels + width * (size_t)frame_height;
+    const uint8_t *v_plane = u_plane + width / 2 * (size_t)(frame_height / 2);
+
+    // the inverse of rgb_to_yuv.
+    #pragma omp parallel for schedule(static) if(parallel)
+    for (int py = 0; py < frame_height; py++)
+    {
+        const uint8_t *y_row = pixels + (size_t)py * width;
+        const uint8_t *u_row = u_plane + (size_t)(py / 2) * (width / 2);
+        const uint8_t *v_row = v_plane + (size_t)(py / 2) * (width / 2);
+        uint32_t *row = xrgb + (size_t)py * stride;
+
+        for (size_t px = 0; px < width; px++)
+        {
+            const int c = 298 * (y_row[px] - 16) + 128;
+            const int d = u_row[px / 2] - 128;
+            const int e = v_row[px / 2] - 128;
+            row[px] = clamp_byte((c + 409 * e) >> 8) << 16 | clamp_byte((c - 100 * d - 208 * e) >> 8) << 8 | clamp_byte((c + 516 * d) >> 8);
+        }
+    }
+}
+
+static Bool is_shm_completion(Display *event_display, XEvent *event, XPointer segment)
+{
+    (void)event_display;
+    return event->type == shm_completion && ((XShmCompletionEvent *)event)->shmseg == *(ShmSeg *)segment;
+}
+
+// puts a drawn frame in the window. nothing is drawn here, so this costs the same whatever the ball count.
+void show_frame(const Canvas *canvas)
+{
+    const int b = window_image;
+    window_image ^= 1;
+
+    // the x server may still be copying this image out from two frames ago.
+    if (window_busy[b])
+    {
+        XEvent event;
+        XIfEvent(display, &event, is_shm_completion, (XPointer)&window_shm[b].shmseg);
+        window_busy[b] = false;
+    }
+
+    XImage *image = window_images[b];
+    frame_to_xrgb((uint32_t *)image->data, (size_t)image->bytes_per_line / 4, canvas->pixels);
+
+    if (window_uses_shm)
+    {
+        XShmPutImage(display, window, gc, image, 0, 0, 0, 0, (unsigned int)frame_width, (unsigned int)frame_height, True);
+        window_busy[b] = true;
+    }
+    else
+        XPutImage(display, window, gc, image, 0, 0, 0, 0, (unsigned int)frame_width, (unsigned int)frame_height);
+
+    XFlush(display);
+}
+
+// shows frame number frame, unless it is already so late that skipping it is the way to catch up.
+void show_on_time(const Canvas *canvas, const uint64_t frame)
+{
+    if (skip_frames && schedule_is_behind(&schedule, frame))
+    {
+        frames_not_shown++;
+        return;
+    }
+
+    show_frame(canvas);
+    lateness_add(&shown_lateness, schedule_now_ns() - schedule_due_ns(&schedule, frame));
+}
+
+void write_to_ffmpeg(const Canvas *canvas)
+{
+    if (!encoder_write(&encoder, canvas->pixels))
+        PERROR("Could not write a frame to ffmpeg: %s", strerror(errno));
+
+    STAT_COUNT_IN(&main_scene, COUNT_PIPED_BYTES, encoder.frame_bytes);
+}
+
+// drawing stage: turns snapshots from the physics thread into frames for the encoding thread.
+void *draw_stage(void *arg)
+{
+    (void)arg;
+    uint32_t snapshot;
+
+    // a new thread starts with omp's own team size, not the one split_team left the main thread.
+    omp_set_num_threads(draw_threads);
+    if (pin_threads)
+        pin_team("drawing", physics_threads, true);
+
+    while (ring_acquire_read(&snapshot_ring, &draw_input_stalls, &snapshot))
+    {
+        const uint32_t frame = ring_acquire_write(&frame_ring, &draw_output_stalls);
+        draw_frame(&frames[frame], &snapshots[snapshot]);
+        ring_release(&snapshot_ring);
+        ring_publish(&frame_ring);
+    }
+
+    ring_finish(&frame_ring);
+    return NULL;
+}
+
+// encoding stage: hands finished frames to ffmpeg and the window. a frame goes back to the drawing stage only once
+// the pipe can't be reading from it anymore.
+void *encode_stage(void *arg)
+{
+    (void)arg;
+    uint32_t frame;
+    uint64_t number = first_frame;
+    int held = 0;
+
+    // the only omp loop here is converting a frame for the window, the cpus are the other two stages'.
+    omp_set_num_threads(1);
+
+    while (ring_acquire_read(&frame_ring, &encode_stalls, &frame))
+    {
+        if (show)
+            show_on_time(&frames[frame], number);
+        number++;
+
+        write_to_ffmpeg(&frames[frame]);
+
+        if (++held > encoder.pipe_frames)
+        {
+            ring_release(&frame_ring);
+            held--;
+        }
+    }
+
+    return NULL;
+}
+
+void start_pipeline()
+{
+    for (int slot = 0; slot < SNAPSHOT_SLOTS; slot++)
+        snapshots[slot] = make_shown();
+
+    if (pthread_create(&draw_thread, NULL, draw_stage, NULL) != 0 ||
+        pthread_create(&encode_thread, NULL, encode_stage, NULL) != 0)
+        PERROR("%s", "Could not start the pipeline threads.");
+}
+
+// physics stage: copies the balls frame shows at the end of the step that just finished into the next free snapshot.
+void push_snapshot(const Scene *scene, const uint64_t frame)
+{
+    const uint32_t slot = ring_acquire_write(&snapshot_ring, &physics_stalls);
+    show_scene(&snapshots[slot], scene, camera_at(frame));
+    ring_publish(&snapshot_ring);
+}
+
+void stop_pipeline()
+{
+    ring_finish(&snapshot_ring);
+    pthread_join(draw_thread, NULL);
+    pthread_join(encode_thread, NULL);
+
+    printf("Pipeline stalls:\n");
+    printf("  physics waiting for a snapshot slot: %8" PRIu64 " times, %10.1f ms\n", physics_stalls.waits, physics_stalls.wait_ms);
+    printf("  drawing waiting for a snapshot:      %8" PRIu64 " times, %10.1f ms\n", draw_input_stalls.waits, draw_input_stalls.wait_ms);
+    printf("  drawing waiting for a frame slot:    %8" PRIu64 " times, %10.1f ms\n", draw_output_stalls.waits, draw_output_stalls.wait_ms);
+    printf("  encoding waiting for a frame:        %8" PRIu64 " times, %10.1f ms\n", encode_stalls.waits, encode_stalls.wait_ms);
+
+    for (int slot = 0; slot < SNAPSHOT_SLOTS; slot++)
+        free_shown(&snapshots[slot]);
+}
+
+// starts an ffmpeg that encodes the raw frames written to it into output.
+void start_encoder(Encoder *frames_encoder, char *output)
+{
+    char video_size[32], frame_rate[16];
+    snprintf(video_size, sizeof(video_size), "%dx%d", frame_width, frame_height);
+    snprintf(frame_rate, sizeof(frame_rate), "%d", fps);
+
+    char *argv[32] = {"ffmpeg", "-y", "-f", "rawvideo", "-pixel_format", yuv420 ? "yuv420p" : "rgb24",
+                      "-video_size", video_size, "-framerate", frame_rate, "-i", "-"};
+    int arg = 12;
+
+    if (!yuv420)
+    {
+        argv[arg++] = "-vf";
+        argv[arg++] = "format=yuv420p";
+    }
+
+    argv[arg++] = "-c:v";
+    argv[arg++] = "libx264";
+    argv[arg++] = "-preset";
+    argv[arg++] = "fast";
+    argv[arg++] = output;
+    argv[arg] = NULL;
+
+    if (!encoder_start(frames_encoder, argv, frame_bytes, ENCODER_PIPE_BYTES))
+        PERROR("Could not start ffmpeg: %s", strerror(errno));
+}
+
+void start_recording()
+{
+    start_encoder(&encoder, output_file);
+
+    printf("Pipe to ffmpeg %d KB.\n", encoder.pipe_bytes / 1024);
+}
+
+// the canvases frames are drawn into. with ffmpeg there are enough that one is never drawn over while
+// the pipe is still reading it, just the window needs only one.
+void make_frames()
+{
+    if (render)
+        frames_in_flight = pipeline ? FRAME_SLOTS + encoder.pipe_frames : encoder.pipe_frames + 1;
+    else
+        frames_in_flight = 1;
+
+    frame_ring.size = (uint32_t)frames_in_flight;
+    frames = MALLOC((size_t)frames_in_flight * sizeof(Canvas));
+
+    for (int frame = 0; frame < frames_in_flight; frame++)
+        frames[frame] = make_canvas();
+
+    frame_shown = make_shown();
+}
+
+void free_frames()
+{
+    for (int frame = 0; frame < frames_in_flight; frame++)
+        free_canvas(&frames[frame]);
+    free(frames);
+    free_shown(&frame_shown);
+}
+
+// waits for ffmpeg to finish the file. the frames can be freed after, until then the pipe may still be reading them.
+void stop_recording()
+{
+    const int status = encoder_stop(&encoder);
+
+    if (status != 0)
+        PERROR("ffmpeg failed with exit status %d.", status);
+
+    printf("Recording stopped and file finalized.\n");
+    printf("Waited for ffmpeg to empty the pipe %" PRIu64 " times, %.1f ms.\n", encoder.stalls.waits, encoder.stalls.wait_ms);
+
+    if (frames_drawn)
+        printf("Drawing touched %.2f MB per frame on average, a frame is %.2f MB.\n",
+            (double)bytes_touched / (double)frames_drawn / 1e6, (double)frame_bytes / 1e6);
+}
+
+void draw_screen(const Scene *scene, const uint64_t frame)
+{
+    if (render && pipeline)
+    {
+        push_snapshot(scene, frame);
+        return;
+    }
+
+    if (!render && !show)
+        return;
+
+    // the frames take turns, by the time one comes round again ffmpeg has read it.
+    Canvas *canvas = &frames[frame % (uint64_t)frames_in_flight];
+    show_scene(&frame_shown, scene, camera_at(frame));
+    draw_frame(canvas, &frame_shown);
+
+    if (show)
+        show_on_time(canvas, frame);
+
+    if (render)
+        write_to_ffmpeg(canvas);
+}
+
+// copies the scene into the checkpoint writer, which writes it out in the background.
+// false while the last checkpoint is still being written.
+bool save_checkpoint(const Scene *scene, const uint64_t next_frame)
+{
+    uint8_t *buffer = checkpoint_begin(&checkpoints);
+    if (!buffer)
+        return false;
+
+    CheckpointHeader *header = (CheckpointHeader *)(void *)buffer;
+    checkpoint_layout(header, scene->num_balls, scene->event_driven ? events_state_bytes(scene->num_balls) : 0);
+    header->frame = next_frame;
+    header->frame_width = frame_width;
+    header->frame_height = frame_height;
+    header->world_width = scene->world_width;
+    header->world_height = scene->world_height;
+    header->ball_size = scene->ball_size;
+    header->ball_size_max = scene->ball_size_max;
+    header->fps = scene->fps;
+    header->seed = scene->seed;
+    header->camera_x = camera_x;
+    header->camera_y = camera_y;
+    header->camera_zoom = camera_zoom;
+    header->pan_x = pan_x;
+    header->pan_y = pan_y;
+    header->neighbour_skin = scene->neighbour_skin;
+    header->yuv420 = yuv420;
+
+    const size_t bytes = (size_t)scene->num_balls * sizeof(float);
+    memcpy(buffer + header->x, scene->balls.x, bytes);
+    memcpy(buffer + header->y, scene->balls.y, bytes);
+    memcpy(buffer + header->vx, scene->balls.vx, bytes);
+    memcpy(buffer + header->vy, scene->balls.vy, bytes);
+    memcpy(buffer + header->color, scene->balls.color, (size_t)scene->num_balls * sizeof(*scene->balls.color));
+    memcpy(buffer + header->size, scene->balls.size, bytes);
+
+    if (scene->event_driven)
+        events_save(&scene->events, buffer + header->events);
+
+    char path[TEXT_OPTION_BYTES + 32];
+    snprintf(path, sizeof(path), "%s.%09" PRIu64 ".ckpt", checkpoint_prefix, next_frame);
+
+    if (!checkpoint_commit(&checkpoints, path))
+        PERROR("%s", "Could not start the checkpoint thread.");
+
+    return true;
+}
+
+void start_checkpoints(const Scene *scene)
+{
+    CheckpointHeader layout;
+    checkpoint_layout(&layout, scene->num_balls, scene->event_driven ? events_state_bytes(scene->num_balls) : 0);
+
+    // the padding between the arrays stays zero, so the same scene always gives the same file.
+    checkpoints.buffer = ALIGNED_MALLOC(CHECKPOINT_ALIGN, layout.file_bytes);
+    memset(checkpoints.buffer, 0, layout.file_bytes);
+}
+
+void stop_checkpoints()
+{
+    checkpoint_finish(&checkpoints);
+
+    printf("Wrote %" PRIu64 " checkpoints, %" PRIu64 " failed, put one off %" PRIu64 " times while the last was being written.\n",
+        checkpoints.written, checkpoints.failed, checkpoints.refused);
+
+    free(checkpoints.buffer);
+}
+
+void start_events(Scene *scene)
+{
+    if (!events_start(&scene->events, scene->num_balls, scene->ball_size, scene->world_width, scene->world_height))
+        PERROR("Could not start the event driven physics: %s", strerror(errno));
+}
+
+// what the event driven engine did over the run.
+void stop_events(Scene *scene)
+{
+    const EventCounts *total = &scene->events.total;
+    const double simulated = scene->events.now - (double)first_frame;
+
+    printf("Event driven physics: %" PRIu64 " events in %.0f frames, %.1f a frame. %" PRIu64 " collisions, %" PRIu64 " wall bounces, "
+        "%" PRIu64 " cell crossings, %" PRIu64 " stale, %.1f balls tested an event.\n",
+        total->events, simulated, simulated > 0.0 ? (double)total->events / simulated : 0.0, total->collisions, total->bounces,
+        total->crossings, total->stale, total->events ? (double)total->pair_tests / (double)total->events : 0.0);
+
+    events_stop(&scene->events);
+}
+
+// takes the scene settings from the checkpoint to resume from. its arrays are copied out by restore_checkpoint.
+// the camera and the frame format come from it too, so the frames carry on from the ones already drawn. ffmpeg starts
+// --output over though, the resumed video begins at the checkpoint's frame and is joined to the earlier one after.
+void open_checkpoint()
+{
+    const char *error;
+    resume = checkpoint_map(resume_file, &error);
+
+    if (!resume)
+        PERROR("Could not resume from %s: %s", resume_file, error);
+
+    frame_width = resume->frame_width;
+    frame_height = resume->frame_height;
+    world_width = resume->world_width;
+    world_height = resume->world_height;
+    num_balls = resume->num_balls;
+    ball_size = resume->ball_size;
+    ball_size_max = resume->ball_size_max;
+    fps = resume->fps;
+    scene_seed = resume->seed;
+    first_frame = resume->frame;
+    camera_x = resume->camera_x;
+    camera_y = resume->camera_y;
+    camera_zoom = resume->camera_zoom;
+    pan_x = resume->pan_x;
+    pan_y = resume->pan_y;
+    neighbour_skin = resume->neighbour_skin;
+    yuv420 = resume->yuv420 != 0;
+
+    // a run carries on with the physics it was started with.
+    event_driven = resume->event_bytes != 0;
+    if (event_driven && resume->event_bytes != events_state_bytes(num_balls))
+        PERROR("Could not resume from %s: %s", resume_file, "checkpoint is truncated or damaged");
+}
+
+void restore_checkpoint(Scene *scene)
+{
+    const uint8_t *bytes = (const uint8_t *)resume;
+    const size_t size = (size_t)scene->num_balls * sizeof(float);
+
+    memcpy(scene->balls.x, bytes + resume->x, size);
+    memcpy(scene->balls.y, bytes + resume->y, size);
+    memcpy(scene->balls.vx, bytes + resume->vx, size);
+    memcpy(scene->balls.vy, bytes + resume->vy, size);
+    memcpy(scene->balls.color, bytes + resume->color, (size_t)scene->num_balls * sizeof(*scene->balls.color));
+    memcpy(scene->balls.size, bytes + resume->size, size);
+
+    for (int i = 0; i < scene->num_balls; i++)
+        scene->balls.yuv[i] = rgb_to_yuv(scene->balls.color[i]);
+
+    apply_sizes(scene);
+
+    if (scene->event_driven)
+    {
+        start_events(scene);
+        if (!events_restore(&scene->events, bytes + resume->events))
+            PERROR("Could not resume from %s: %s", resume_file, "checkpoint is truncated or damaged");
+    }
+
+    checkpoint_unmap(resume);
+    resume = NULL;
+}
+
+// reserves the trajectory file at path for every frame up to last_frame.
+void start_trajectory(Scene *scene, const char *path, const uint64_t last_frame)
+{
+
+    TrajectoryHeader layout;
+    trajectory_layout(&layout, scene->num_balls, last_frame >= first_frame ? last_frame - first_frame + 1 : 0);
+    layout.first_frame = first_frame;
+    layout.frame_width = frame_width;
+    layout.frame_height = frame_height;
+    layout.world_width = scene->world_width;
+    layout.world_height = scene->world_height;
+    layout.ball_size = scene->ball_size;
+    layout.fps = scene->fps;
+    layout.seed = scene->seed;
+
+    if (!trajectory_create(&scene->trajectory, path, &layout, scene->balls.color, scene->balls.size))
+        PERROR("Could not create %s: %s", path, strerror(errno));
+
+    printf("Recording %" PRIu64 " frames to %s, %.1f MB.\n", layout.capacity, path,
+        (double)trajectory_file_bytes(&layout, layout.capacity) / 1e6);
+}
+
+void record_frame(Scene *scene, const char *path)
+{
+    if (!trajectory_append(&scene->trajectory, scene->balls.x, scene->balls.y, scene->balls.vx, scene->balls.vy))
+        PERROR("%s is full.", path);
+}
+
+void stop_trajectory(Scene *scene, const char *path, const int64_t start_ns)
+{
+    const uint64_t recorded = scene->trajectory.header->frames;
+    const double seconds = (double)(schedule_now_ns() - start_ns) / 1e9;
+
+    if (!trajectory_close(&scene->trajectory))
+        PERROR("Could not finish %s: %s", path, strerror(errno));
+
+    printf("Recorded %" PRIu64 " frames to %s in %.2f s, %.0f frames/s.\n", recorded, path, seconds, (double)recorded / seconds);
+}
+
+void simulate(Scene *scene)
+{
+    const uint64_t last_frame = (uint64_t)num_seconds * (uint64_t)fps;
+    const uint64_t checkpoint_frames = (uint64_t)checkpoint_seconds * (uint64_t)fps;
+    bool checkpoint_due = false;
+
+    schedule_start(&schedule, fps, first_frame);
+
+    for (uint64_t frame = first_frame; frame <= last_frame; frame++)
+    {
+        if (show && close_on_key_press())
+            return;
+
+        STAT_BEGIN_FRAME()
+        update_positions(scene);
+
+        if (record_file[0])
+            record_frame(scene, record_file);
+        else
+            draw_screen(scene, frame);
+
+        STAT_END_PHASE(STATS_OUTPUT)
+        STAT_END_FRAME(frame)
+
+        // a checkpoint the writer isn't ready for is tried again on the next frame.
+        if (checkpoint_frames && (frame + 1) % checkpoint_frames == 0)
+            checkpoint_due = true;
+
+        if (checkpoint_due && save_checkpoint(scene, frame + 1))
+            checkpoint_due = false;
+
+        // a recording has nothing to keep up with, it runs as fast as the physics can.
+        if (!record_file[0])
+            schedule_wait(&schedule, !skip_frames);
+    }
+}
+
+#ifdef STATS
+void start_stats()
+{
+    const char *perf_error;
+
+    if (!stats_open(&main_scene.stats, stats_file, stats_phase_names, NUM_STATS_PHASES, &perf_error))
+        PERROR("Could not create %s: %s", stats_file, strerror(errno));
+
+    if (perf_error)
+        printf("No hardware counters, writing counts and times only: %s\n", perf_error);
+}
+
+void stop_stats()
+{
+    if (!stats_close(&main_scene.stats))
+        PERROR("Could not write %s: %s", stats_file, strerror(errno));
+}
+#endif
+
+void print_schedule()
+{
+    printf("Frames at %d fps: %" PRIu64 " started late, %" PRIu64 " not shown to catch up.\n",
+        fps, schedule.missed, frames_not_shown);
+
+    lateness_print("Frame start after its deadline", &schedule.woke);
+
+    if (show)
+        lateness_print("Frame shown after its deadline", &shown_lateness);
+}
+
+// how often the neighbour lists had to be built again, and how many pairs they held.
+void print_neighbour_builds(const Scene *scene)
+{
+    if (!scene->neighbour_skin)
+        return;
+
+    printf("Neighbour lists with a %d px skin built %" PRIu64 " times in %" PRIu64 " frames, once every %.1f frames, %.1f pairs per ball.\n",
+        scene->neighbour_skin, scene->neighbour_builds, scene->broad_phases, scene->neighbour_builds ? (double)scene->broad_phases / (double)scene->neighbour_builds : 0.0,
+        (double)scene->neighbour_pairs.count / scene->num_balls);
+}
+
+// takes the scene from the trajectory to play and fits its world into the frame.
+void open_trajectory()
+{
+    const char *error;
+    playback = trajectory_map(play_file, &error);
+
+    if (!playback)
+        PERROR("Could not play %s: %s", play_file, error);
+
+    world_width = playback->world_width;
+    world_height = playback->world_height;
+    num_balls = playback->num_balls;
+    fps = playback->fps;
+    scene_seed = playback->seed;
+
+    if ((uint64_t)num_segments > playback->frames)
+        num_segments = (int)playback->frames;
+
+    // without a zoom of its own the camera takes all of the world in.
+    if (camera_zoom <= 0.0f)
+        camera_zoom = fminf((float)frame_width / (float)world_width, (float)frame_height / (float)world_height);
+
+    // the largest size sets how far the span table goes.
+    const float *sizes = trajectory_sizes(playback);
+    float largest = 0.0f;
+    for (int i = 0; i < num_balls; i++)
+        largest = fmaxf(largest, sizes[i]);
+
+    ball_size = playback->ball_size;
+    ball_size_max = (int)lroundf(largest);
+}
+
+// the recorded sizes, and the sizes they are drawn at.
+void play_sizes()
+{
+    memcpy(main_scene.balls.size, trajectory_sizes(playback), (size_t)num_balls * sizeof(float));
+    apply_sizes(&main_scene);
+    apply_draw_sizes(&main_scene);
+}
+
+// the recorded colours, or new ones.
+void play_colours()
+{
+    if (recolour_seed)
+    {
+        pick_colours(&main_scene, (uint64_t)recolour_seed);
+        return;
+    }
+
+    memcpy(main_scene.balls.color, trajectory_colors(playback), (size_t)num_balls * sizeof(uint32_t));
+
+    for (int i = 0; i < num_balls; i++)
+        main_scene.balls.yuv[i] = rgb_to_yuv(main_scene.balls.color[i]);
+}
+
+// draws every num_play_workers-th frame of the trajectory into its own canvases.
+typedef struct
+{
+    pthread_t thread;
+    uint64_t first;     // the first frame it draws
+    Ring ring;          // its canvases, handed to the main thread in frame order
+    Canvas *canvases;
+    Shown shown;        // the balls of the frame being drawn
+    Stalls stalls;      // waiting for the main thread to hand a canvas back
+} PlayWorker;
+
+PlayWorker *play_workers;
+int num_play_workers;
+_Atomic int next_segment;
+
+// draws frame k of the trajectory into canvas, with the camera where it was on that frame of the run.
+void play_frame(PlayWorker *worker, Canvas *canvas, const uint64_t k)
+{
+    const float *xs = trajectory_array(playback, k, TRAJECTORY_X);
+    const float *ys = trajectory_array(playback, k, TRAJECTORY_Y);
+
+    show_all(&worker->shown, xs, ys, camera_at(playback->first_frame + k));
+    draw_frame(canvas, &worker->shown);
+}
+
+void *play_stage(void *arg)
+{
+    PlayWorker *worker = arg;
+
+    // there is a worker for every core already.
+    omp_set_num_threads(1);
+
+    for (uint64_t k = worker->first; k < playback->frames; k += (uint64_t)num_play_workers)
+    {
+        const uint32_t slot = ring_acquire_write(&worker->ring, &worker->stalls);
+        play_frame(worker, &worker->canvases[slot], k);
+        ring_publish(&worker->ring);
+    }
+
+    ring_finish(&worker->ring);
+    return NULL;
+}
+
+// draws the frames of the trajectory on every core and hands them to ffmpeg in order.
+// frames only depend on the recorded positions, so any worker can draw any frame.
+void play_trajectory()
+{
+    // the pipe may still be reading the last held_frames frames written.
+    const int held_frames = render ? encoder.pipe_frames : 0;
+
+    num_play_workers = omp_get_max_threads();
+    if ((uint64_t)num_play_workers > playback->frames)
+        num_play_workers = (int)playback->frames;
+
+    // a worker whose next frame is being waited for has at most this many held by the pipe, and needs one more to draw into.
+    const int slots = (held_frames + num_play_workers - 1) / num_play_workers + 2;
+
+    play_workers = MALLOC((size_t)num_play_workers * sizeof(PlayWorker));
+
+    for (int w = 0; w < num_play_workers; w++)
+    {
+        PlayWorker *worker = &play_workers[w];
+        *worker = (PlayWorker){.first = (uint64_t)w, .ring = {.size = (uint32_t)slots}};
+
+        worker->canvases = MALLOC((size_t)slots * sizeof(Canvas));
+        for (int slot = 0; slot < slots; slot++)
+            worker->canvases[slot] = make_canvas();
+
+        worker->shown = make_shown();
+    }
+
+    printf("Playing %" PRIu64 " frames of %s at %dx%d, %d workers.\n", playback->frames, play_file, frame_width, frame_height, num_play_workers);
+
+    const int64_t start_ns = schedule_now_ns();
+
+    for (int w = 0; w < num_play_workers; w++)
+        if (pthread_create(&play_workers[w].thread, NULL, play_stage, &play_workers[w]) != 0)
+            PERROR("%s", "Could not start the play threads.");
+
+    for (uint64_t k = 0; k < playback->frames; k++)
+    {
+        PlayWorker *worker = &play_workers[k % (uint64_t)num_play_workers];
+        uint32_t slot;
+
+        if (!ring_acquire_read(&worker->ring, &encode_stalls, &slot))
+            PERROR("A play thread stopped before frame %" PRIu64 ".", k);
+
+        if (render)
+            write_to_ffmpeg(&worker->canvases[slot]);
+
+        if (k >= (uint64_t)held_frames)
+            ring_release(&play_workers[(k - (uint64_t)held_frames) % (uint64_t)num_play_workers].ring);
+    }
+
+    Stalls draw_stalls = {0};
+    for (int w = 0; w < num_play_workers; w++)
+    {
+        pthread_join(play_workers[w].thread, NULL);
+        draw_stalls.waits += play_workers[w].stalls.waits;
+        draw_stalls.wait_ms += play_workers[w].stalls.wait_ms;
+    }
+
+    const double seconds = (double)(schedule_now_ns() - start_ns) / 1e9;
+
+    printf("Played %" PRIu64 " frames in %.2f s, %.0f frames/s.\n", playback->frames, seconds, (double)playback->frames / seconds);
+    printf("  drawing waiting for a frame slot:    %8" PRIu64 " times, %10.1f ms\n", draw_stalls.waits, draw_stalls.wait_ms);
+    printf("  encoding waiting for a frame:        %8" PRIu64 " times, %10.1f ms\n", encode_stalls.waits, encode_stalls.wait_ms);
+}
+
+// file with .<tag><number> before its extension.
+void numbered_path(char *path, const size_t bytes, const char *file, const char *tag, const int number)
+{
+    const char *slash = strrchr(file, '/');
+    const char *dot = strrchr(file, '.');
+
+    if (!dot || (slash && dot < slash))
+        dot = file + strlen(file);
+
+    snprintf(path, bytes, "%.*s.%s%03d%s", (int)(dot - file), file, tag, number, dot);
+}
+
+// output_file with .seg<segment> before its extension.
+void segment_path(char *path, const size_t bytes, const int segment)
+{
+    numbered_path(path, bytes, output_file, "seg", segment);
+}
+
+// takes whole segments until there are none left, and draws and encodes each one on its own.
+void *segment_stage(void *arg)
+{
+    PlayWorker *worker = arg;
+
+    // there is a worker for every core already, and an encoder next to each.
+    omp_set_num_threads(1);
+
+    for (int segment = next_segment++; segment < num_segments; segment = next_segment++)
+    {
+        const uint64_t begin = playback->frames * (uint64_t)segment / (uint64_t)num_segments;
+        const uint64_t end = playback->frames * (uint64_t)(segment + 1) / (uint64_t)num_segments;
+
+        char path[TEXT_OPTION_BYTES + 16];
+        segment_path(path, sizeof(path), segment);
+
+        Encoder segment_encoder;
+        start_encoder(&segment_encoder, path);
+
+        // the canvases take turns, by the time one comes round again ffmpeg has read it.
+        const int slots = segment_encoder.pipe_frames + 1;
+        Canvas *canvases = MALLOC((size_t)slots * sizeof(Canvas));
+        for (int slot = 0; slot < slots; slot++)
+            canvases[slot] = make_canvas();
+
+        for (uint64_t k = begin; k < end; k++)
+        {
+            Canvas *canvas = &canvases[(k - begin) % (uint64_t)slots];
+            play_frame(worker, canvas, k);
+
+            if (!encoder_write(&segment_encoder, canvas->pixels))
+                PERROR("Could not write a frame to ffmpeg: %s", strerror(errno));
+        }
+
+        const int status = encoder_stop(&segment_encoder);
+        if (status != 0)
+            PERROR("ffmpeg failed on %s with exit status %d.", path, status);
+
+        worker->stalls.waits += segment_encoder.stalls.waits;
+        worker->stalls.wait_ms += segment_encoder.stalls.wait_ms;
+
+        for (int slot = 0; slot < slots; slot++)
+            free_canvas(&canvases[slot]);
+        free(canvases);
+    }
+
+    return NULL;
+}
+
+// puts the segments back together into output_file. every segment is a whole encode of its own, so each one
+// starts on a keyframe and the concat demuxer can join them without encoding anything again.
+void join_segments()
+{
+    char list[TEXT_OPTION_BYTES + 16];
+    snprintf(list, sizeof(list), "%s.segments.txt", output_file);
+
+    OPEN(fp, list, "w");
+
+    // the list sits next to the segments, and the names in it are relative to it.
+    for (int segment = 0; segment < num_segments; segment++)
+    {
+        char path[TEXT_OPTION_BYTES + 16];
+        segment_path(path, sizeof(path), segment);
+
+        const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+        fputs("file '", fp);
+        // a quote in the name closes the quoted string, puts an escaped quote in, and opens it again.
+        for (const char *c = name; *c; c++)
+        {
+            if (*c == '\'')
+                fputs("'\\''", fp);
+            else
+                fputc(*c, fp);
+        }
+        fputs("'\n", fp);
+    }
+
+    CLOSE(fp);
+
+    char *argv[] = {"ffmpeg", "-y", "-nostdin", "-f", "concat", "-safe", "0", "-i", list, "-c", "copy", output_file, NULL};
+    const int status = encoder_run(argv);
+
+    if (status != 0)
+        PERROR("Joining the segments listed in %s failed with exit status %d.", list, status);
+
+    for (int segment = 0; segment < num_segments; segment++)
+    {
+        char path[TEXT_OPTION_BYTES + 16];
+        segment_path(path, sizeof(path), segment);
+        unlink(path);
+    }
+    unlink(list);
+
+    printf("Joined %d segments into %s.\n", num_segments, output_file);
+}
+
+// like play_trajectory, but with the video cut into num_segments pieces that each have their own ffmpeg,
+// so encoding runs on every core as well instead of being bound by one encoder.
+void play_segments()
+{
+    num_play_workers = omp_get_max_threads();
+    if (num_play_workers > num_segments)
+        num_play_workers = num_segments;
+
+    play_workers = MALLOC((size_t)num_play_workers * sizeof(PlayWorker));
+
+    for (int w = 0; w < num_play_workers; w++)
+    {
+        play_workers[w] = (PlayWorker){0};
+        play_workers[w].shown = make_shown();
+    }
+
+    printf("Playing %" PRIu64 " frames of %s at %dx%d, %d segments on %d workers.\n",
+        playback->frames, play_file, frame_width, frame_height, num_segments, num_play_workers);
+
+    const int64_t start_ns = schedule_now_ns();
+
+    for (int w = 0; w < num_play_workers; w++)
+        if (pthread_create(&play_workers[w].thread, NULL, segment_stage, &play_workers[w]) != 0)
+            PERROR("%s", "Could not start the play threads.");
+
+    Stalls pipe_stalls = {0};
+    for (int w = 0; w < num_play_workers; w++)
+    {
+        pthread_join(play_workers[w].thread, NULL);
+        pipe_stalls.waits += play_workers[w].stalls.waits;
+        pipe_stalls.wait_ms += play_workers[w].stalls.wait_ms;
+    }
+
+    const double seconds = (double)(schedule_now_ns() - start_ns) / 1e9;
+
+    printf("Played %" PRIu64 " frames in %.2f s, %.0f frames/s.\n", playback->frames, seconds, (double)playback->frames / seconds);
+    printf("Waited for the encoders to empty their pipes %" PRIu64 " times, %.1f ms.\n", pipe_stalls.waits, pipe_stalls.wait_ms);
+
+    join_segments();
+}
+
+// the canvases can only go once ffmpeg is done with them, see stop_recording.
+void stop_playback()
+{
+    for (int w = 0; w < num_play_workers; w++)
+    {
+        for (uint32_t slot = 0; slot < play_workers[w].ring.size; slot++)
+            free_canvas(&play_workers[w].canvases[slot]);
+
+        free(play_workers[w].canvases);
+        free_shown(&play_workers[w].shown);
+    }
+
+    free(play_workers);
+    trajectory_unmap(playback);
+    playback = NULL;
+}
+
+double now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+typedef enum
+{
+    PHASE_INTEGRATE,
+    PHASE_BROAD,
+    PHASE_NARROW,
+    PHASE_RASTER,
+    PHASE_DIRTY,
+    NUM_PHASES
+} Phase;
+
+const char *phase_names[NUM_PHASES] = {"integrate", "broad", "narrow", "raster", "dirty"};
+
+int compare_doubles(const void *a, const void *b)
+{
+    const double da = *(const double *)a;
+    const double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// runs num_frames frames of a scene with count balls and fills median[] with the median ms of every phase.
+// density is the number of balls per pixel of the configured scene: the world grows with the ball count.
+void bench_scene(const int count, const double density, const int num_frames, double median[NUM_PHASES])
+{
+    const double scale = sqrt((double)count / density / ((double)frame_width * frame_height));
+    num_balls = count;
+    world_width = scale > 1.0 ? (int)(frame_width * scale) : frame_width;
+    world_height = scale > 1.0 ? (int)(frame_height * scale) : frame_height;
+
+    Scene *scene = &main_scene;
+    scene_settings(scene);
+    alloc_scene(scene);
+    make_balls(scene, BENCH_SEED);
+    apply_draw_sizes(scene);
+
+    if (event_driven)
+    {
+        start_events(scene);
+        events_load(&scene->events, scene->balls.x, scene->balls.y, scene->balls.vx, scene->balls.vy, 0.0);
+    }
+
+    // raster redraws a whole frame, dirty only what moved since the frame before. both draw what the camera shows,
+    // raster's time includes finding it.
+    Canvas full = make_canvas(), dirty = make_canvas();
+    Shown bench_shown = make_shown();
+    uint64_t full_bytes = 0, dirty_bytes = 0;
+
+    double *samples[NUM_PHASES];
+    for (int p = 0; p < NUM_PHASES; p++)
+        samples[p] = MALLOC((size_t)num_frames * sizeof(double));
+
+    for (int f = 0; f < num_frames; f++)
+    {
+        double t0 = now_ms(), t1, t2, t3;
+
+        // an event driven frame has its collisions timed as narrow and where the balls are worked out as integrate.
+        if (event_driven)
+        {
+            advance_events(scene);
+            const double collided = now_ms();
+            event_positions(scene);
+            t3 = now_ms();
+            t1 = t0 + (t3 - collided);
+            t2 = t1;
+        }
+        else
+        {
+            scene->physics->integrate_balls(scene);
+            t1 = now_ms();
+            scene->physics->broad_phase(scene);
+            t2 = now_ms();
+            scene->physics->narrow_phase(scene);
+            t3 = now_ms();
+        }
+
+        show_scene(&bench_shown, scene, camera_at((uint64_t)f));
+        full_bytes += renderer.render_frame(&full, &bench_shown);
+        double t4 = now_ms();
+        dirty_bytes += renderer.render_dirty(&dirty, &bench_shown);
+        double t5 = now_ms();
+
+        samples[PHASE_INTEGRATE][f] = t1 - t0;
+        samples[PHASE_BROAD][f] = t2 - t1;
+        samples[PHASE_NARROW][f] = t3 - t2;
+        samples[PHASE_RASTER][f] = t4 - t3;
+        samples[PHASE_DIRTY][f] = t5 - t4;
+    }
+
+    printf("\n%d balls, %dx%d world, %d frames\n", count, world_width, world_height, num_frames);
+    printf("  %-10s %10s %10s %10s\n", "phase", "min ms", "median ms", "p99 ms");
+
+    for (int p = 0; p < NUM_PHASES; p++)
+    {
+        qsort(samples[p], (size_t)num_frames, sizeof(double), compare_doubles);
+        const int p99 = (int)ceil(0.99 * num_frames) - 1;
+        median[p] = samples[p][num_frames / 2];
+        printf("  %-10s %10.3f %10.3f %10.3f\n", phase_names[p], samples[p][0], median[p], samples[p][p99]);
+        free(samples[p]);
+    }
+
+    printf("  touched    %10.3f MB per frame by raster, %.3f MB by dirty\n",
+        (double)full_bytes / num_frames / 1e6, (double)dirty_bytes / num_frames / 1e6);
+
+    if (event_driven)
+    {
+        printf("  events     %10.1f per frame, %.1f collisions, %.1f balls tested an event\n",
+            (double)scene->events.total.events / num_frames, (double)scene->events.total.collisions / num_frames,
+            scene->events.total.events ? (double)scene->events.total.pair_tests / (double)scene->events.total.events : 0.0);
+        events_stop(&scene->events);
+    }
+    else if (neighbour_skin)
+        printf("  neighbours %10.1f frames per build, %.1f pairs per ball\n",
+            scene->neighbour_builds ? (double)scene->broad_phases / (double)scene->neighbour_builds : 0.0, (double)scene->neighbour_pairs.count / count);
+
+    free_canvas(&full);
+    free_canvas(&dirty);
+    free_shown(&bench_shown);
+    free_scene(scene);
+}
+
+// sweeps the ball count from 10^2 to 10^6 and prints how the median cost per ball of every phase changes.
+void run_benchmark(const int num_frames)
+{
+    enum { NUM_COUNTS = 5 };
+    const int counts[NUM_COUNTS] = {100, 1000, 10000, 100000, 1000000};
+    const double density = (double)num_balls / ((double)frame_width * frame_height);
+    double median[NUM_COUNTS][NUM_PHASES];
+    scene_settings(&main_scene);
+
+    printf("Benchmark: seed %d, %d threads, %d px balls, %dx%d frame, %s physics, %s rasterizer\n",
+        BENCH_SEED, omp_get_max_threads(), ball_size, frame_width, frame_height,
+        select_physics(&main_scene)->ball_size ? "specialised" : "generic", renderer.draw_size ? "specialised" : "generic");
+
+    if (mixed_sizes)
+        printf("Mixed sizes from %d to %d px\n", ball_size, ball_size_max);
+
+    if (event_driven)
+        printf("Event driven physics\n");
+    else if (neighbour_skin)
+        printf("Neighbour lists with a %d px skin\n", neighbour_skin);
+
+    for (int c = 0; c < NUM_COUNTS; c++)
+        bench_scene(counts[c], density, num_frames, median[c]);
+
+    printf("\nmedian ns per ball\n  %10s", "balls");
+    for (int p = 0; p < NUM_PHASES; p++)
+        printf(" %10s", phase_names[p]);
+    printf("\n");
+
+    for (int c = 0; c < NUM_COUNTS; c++)
+    {
+        printf("  %10d", counts[c]);
+        for (int p = 0; p < NUM_PHASES; p++)
+            printf(" %10.2f", median[c][p] * 1e6 / counts[c]);
+        printf("\n");
+    }
+}
+
+
+
+
+typedef enum
+{
+    OPTION_INT,
+    OPTION_FLOAT,
+    OPTION_BOOL,
+    OPTION_STRING
+} OptionType;
+
+typedef struct
+{
+    const char *name;
+    OptionType type;
+    void *value;
+    const char *help;
+} Option;
+
+int bench_frames = 0; // 0: normal run, otherwise the number of frames per benchmark scene
+
+const Option options[] = {
+    {"width",      OPTION_INT,    &frame_width,        "frame width in pixels"},
+    {"height",     OPTION_INT,    &frame_height,       "frame height in pixels"},
+    {"world-width", OPTION_INT,   &world_width,        "world width in pixels, 0 for the frame width"},
+    {"world-height", OPTION_INT,  &world_height,       "world height in pixels, 0 for the frame height"},
+    {"camera-x",   OPTION_INT,    &camera_x,           "world pixel at the left edge of the frame at the start"},
+    {"camera-y",   OPTION_INT,    &camera_y,           "world pixel at the top edge of the frame at the start"},
+    {"zoom",       OPTION_FLOAT,  &camera_zoom,        "frame pixels per world pixel, 0 for 1, or all of the world with --play"},
+    {"pan-x",      OPTION_FLOAT,  &pan_x,              "world pixels a second the camera moves right, it turns round at the edges"},
+    {"pan-y",      OPTION_FLOAT,  &pan_y,              "world pixels a second the camera moves down, it turns round at the edges"},
+    {"balls",      OPTION_INT,    &num_balls,          "number of balls"},
+    {"size",       OPTION_INT,    &ball_size,          "ball diameter in pixels"},
+    {"size-max",   OPTION_INT,    &ball_size_max,      "largest ball diameter, sizes are spread from --size up to this, 0 for one size"},
+    {"fps",        OPTION_INT,    &fps,                "frames per second"},
+    {"seconds",    OPTION_INT,    &num_seconds,        "length of the run"},
+    {"render",     OPTION_BOOL,   &render,             "pipe the frames to ffmpeg"},
+    {"show",       OPTION_BOOL,   &show,               "show the frames in a window"},
+    {"pipeline",   OPTION_BOOL,   &pipeline,           "physics, drawing and encoding on their own threads"},
+    {"yuv",        OPTION_BOOL,   &yuv420,             "draw yuv420 frames for ffmpeg instead of rgb24"},
+    {"dirty",      OPTION_BOOL,   &dirty_regions,      "redraw only the parts of the frame that changed"},
+    {"skip",       OPTION_BOOL,   &skip_frames,        "when behind, skip showing frames instead of slowing down"},
+    {"pin",        OPTION_BOOL,   &pin_threads,        "pin the omp threads to a cpu each"},
+    {"events",     OPTION_BOOL,   &event_driven,       "exact event driven physics instead of time steps"},
+    {"output",     OPTION_STRING, output_file,         "video file ffmpeg writes"},
+    {"seed",       OPTION_INT,    &scene_seed,         "seed for the starting scene, 0 picks one from the clock"},
+    {"bench",      OPTION_INT,    &bench_frames,       "headless benchmark, frames per ball count"},
+    {"checkpoint", OPTION_INT,    &checkpoint_seconds, "write a checkpoint every this many seconds of video, 0 for none"},
+    {"skin",       OPTION_INT,    &neighbour_skin,     "pixels past touching that the neighbour lists reach, 0 searches the grid every frame"},
+    {"ckpt-file",  OPTION_STRING, checkpoint_prefix,   "checkpoints are written to <this>.<frame>.ckpt"},
+    {"resume",     OPTION_STRING, resume_file,         "carry on from a checkpoint, the scene, camera and frame format come from it, --output starts at its frame"},
+    {"stats",      OPTION_STRING, stats_file,          "write counts, phase times and hardware counters of every frame, json if it ends in .json"},
+    {"record",     OPTION_STRING, record_file,         "physics only, every frame goes to this trajectory file"},
+    {"play",       OPTION_STRING, play_file,           "draw the frames of a trajectory file at --width x --height on every core"},
+    {"recolour",   OPTION_INT,    &recolour_seed,      "with --play, new ball colours from this seed, 0 keeps the recorded ones"},
+    {"segments",   OPTION_INT,    &num_segments,       "with --play, encode the video in this many pieces at once and join them"},
+    {"batch",      OPTION_STRING, batch_file,          "run every line of this file as a scene of its own, its options on top of these. physics only, nothing is drawn or checkpointed"},
+    {"jobs",       OPTION_INT,    &batch_jobs,         "with --batch, scenes running at once, 0 for one per cpu"},
+};
+
+#define NUM_OPTIONS (int)(sizeof(options) / sizeof(options[0]))
+
+void print_usage(const char *program)
+{
+    printf("usage: %s [--config file] [--option value | --flag | --no-flag]...\n\n", program);
+
+    for (int k = 0; k < NUM_OPTIONS; k++)
+        printf("  --%-12s %-8s %s\n", options[k].name,
+            options[k].type == OPTION_INT ? "<int>" : options[k].type == OPTION_FLOAT ? "<number>" :
+            options[k].type == OPTION_STRING ? "<text>" : "", options[k].help);
+
+    printf("\na config file holds one \"name = value\" per line, # starts a comment.\n");
+}
+
+// sets one option from text. false if there is no option with that name or the value doesn't parse.
+bool is_bool_option(const char *name)
+{
+    for (int k = 0; k < NUM_OPTIONS; k++)
+        if (!strcmp(options[k].name, name))
+            return options[k].type == OPTION_BOOL;
+
+    return false;
+}
+
+bool set_option(const char *name, const char *value)
+{
+    for (int k = 0; k < NUM_OPTIONS; k++)
+    {
+        if (strcmp(options[k].name, name) != 0)
+            continue;
+
+        switch (options[k].type)
+        {
+            case OPTION_INT:
+            {
+                char *stop;
+                const long number = strtol(value, &stop, 10);
+                if (*value == '\0' || *stop != '\0' || number < 0 || number > INT32_MAX)
+                    return false;
+                *(int *)options[k].value = (int)number;
+                return true;
+            }
+            case OPTION_FLOAT:
+            {
+                char *stop;
+                const double number = strtod(value, &stop);
+                if (*value == '\0' || *stop != '\0' || number < -1e9 || number > 1e9)
+                    return false;
+                *(float *)options[k].value = (float)number;
+                return true;
+            }
+            case OPTION_BOOL:
+                if (!strcmp(value, "true") || !strcmp(value, "yes") || !strcmp(value, "1"))
+                    *(bool *)options[k].value = true;
+                else if (!strcmp(value, "false") || !strcmp(value, "no") || !strcmp(value, "0"))
+                    *(bool *)options[k].value = false;
+                else
+                    return false;
+                return true;
+            case OPTION_STRING:
+                if (strlen(value) >= TEXT_OPTION_BYTES)
+                    return false;
+                strcpy((char *)options[k].value, value);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+// reads "name = value" lines. blank lines and anything after a # are ignored.
+void read_config_file(const char *file_name)
+{
+    OPEN(fp, file_name, "r");
+
+    char line[512];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+
+        line[strcspn(line, "#\n")] = '\0';
+
+        char name[64], value[256];
+        const int fields = sscanf(line, " %63[^= \t\n] = %255s", name, value);
+
+        if (fields == EOF || fields == 0)
+            continue;
+
+        if (fields != 2 || !set_option(name, value))
+            PERROR("%s:%d: bad setting: %s", file_name, line_number, line);
+    }
+
+    CLOSE(fp);
+}
+
+// the settings every run needs to make sense, from the command line or a checkpoint.
+void check_settings()
+{
+    const int largest = ball_size_max > ball_size ? ball_size_max : ball_size;
+
+    if (!world_width)
+        world_width = frame_width;
+    if (!world_height)
+        world_height = frame_height;
+
+    if (world_width <= 2 * largest || world_height <= 2 * largest || ball_size < 2)
+        PERROR("The %dx%d world is too small for %d px balls.", world_width, world_height, largest);
+
+    if (frame_width < 2 || frame_height < 2)
+        PERROR("%s", "The frame needs to be at least 2x2.");
+
+    if (camera_zoom < 0.0f || (camera_zoom > 0.0f && camera_zoom < 0.01f) || camera_zoom > 100.0f)
+        PERROR("%s", "--zoom goes from 0.01 to 100, or 0.");
+
+    if (ball_size_max && ball_size_max < ball_size)
+        PERROR("%s", "--size-max can't be smaller than --size.");
+
+    if ((int64_t)ball_size_max > (int64_t)ball_size << (MAX_SIZE_LEVELS - 1))
+        PERROR("--size-max can be at most %d times --size.", 1 << (MAX_SIZE_LEVELS - 1));
+
+    if (yuv420 && (frame_width % 2 || frame_height % 2))
+        PERROR("yuv420 needs an even frame size, not %dx%d.", frame_width, frame_height);
+
+    if (num_balls < 1 || fps < 1)
+        PERROR("%s", "Need at least one ball and one frame per second.");
+
+    if (neighbour_skin < 0)
+        PERROR("%s", "--skin can't be negative.");
+
+    // the event engine and the neighbour lists both take every ball to be the same size.
+    if (ball_size_max > ball_size && !play_file[0] && (event_driven || neighbour_skin))
+        PERROR("%s", "Mixed ball sizes need the grid physics, they don't go with --events or --skin.");
+}
+
+// sets the options in argv, from the command line or a line of a batch, argv[0] being the program or the batch.
+void apply_arguments(const int argc, char **argv)
+{
+    for (int a = 1; a < argc; a++)
+    {
+        const char *arg = argv[a];
+
+        if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+        {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (strncmp(arg, "--", 2) != 0)
+            PERROR("Unexpected argument: %s", arg);
+
+        const char *name = arg + 2;
+
+        if (!strcmp(name, "config") && a + 1 < argc)
+        {
+            read_config_file(argv[++a]);
+            continue;
+        }
+
+        // --flag and --no-flag for booleans
+        if ((is_bool_option(name) && set_option(name, "true")) ||
+            (!strncmp(name, "no-", 3) && is_bool_option(name + 3) && set_option(name + 3, "false")))
+            continue;
+
+        // --bench on its own uses the default frame count
+        if (!strcmp(name, "bench") && (a + 1 == argc || !strncmp(argv[a + 1], "--", 2)))
+        {
+            bench_frames = BENCH_FRAMES;
+            continue;
+        }
+
+        if (a + 1 >= argc || !set_option(name, argv[a + 1]))
+            PERROR("Bad option: %s%s%s", arg, a + 1 < argc ? " " : "", a + 1 < argc ? argv[a + 1] : "");
+
+        a++;
+    }
+}
+
+void parse_arguments(const int argc, char **argv)
+{
+    apply_arguments(argc, argv);
+    check_settings();
+
+    // every scene of a batch is a new run of the physics, from its own line.
+    if (batch_file[0] && (resume_file[0] || play_file[0] || stats_file[0] || bench_frames))
+        PERROR("%s", "--batch runs new scenes, it doesn't go with --resume, --play, --stats or --bench.");
+}
+
+// a scene of a batch: its settings and the run it stands for.
+typedef struct
+{
+    int line;
+    Scene scene;
+    uint64_t last_frame;
+    char record[TEXT_OPTION_BYTES + 16]; // empty when it isn't recorded
+} BatchScene;
+
+size_t option_bytes(const Option *option)
+{
+    switch (option->type)
+    {
+        case OPTION_INT: return sizeof(int);
+        case OPTION_FLOAT: return sizeof(float);
+        case OPTION_BOOL: return sizeof(bool);
+        default: return TEXT_OPTION_BYTES;
+    }
+}
+
+// copies every option into or out of saved, which holds all of them back to back.
+void save_options(uint8_t *saved)
+{
+    for (int k = 0; k < NUM_OPTIONS; saved += option_bytes(&options[k]), k++)
+        memcpy(saved, options[k].value, option_bytes(&options[k]));
+}
+
+void restore_options(const uint8_t *saved)
+{
+    for (int k = 0; k < NUM_OPTIONS; saved += option_bytes(&options[k]), k++)
+        memcpy(options[k].value, saved, option_bytes(&options[k]));
+}
+
+// the settings of a line of the batch: ours with the options on the line on top. the settings are put back after.
+void batch_line_settings(BatchScene *batch, const int number, char *line)
+{
+    size_t saved_bytes = 0;
+    for (int k = 0; k < NUM_OPTIONS; k++)
+        saved_bytes += option_bytes(&options[k]);
+
+    uint8_t *saved = MALLOC(saved_bytes);
+    save_options(saved);
+
+    char our_record[TEXT_OPTION_BYTES];
+    memcpy(our_record, record_file, TEXT_OPTION_BYTES);
+
+    printf("Scene %d, line %d: %s\n", number, batch->line, line + strspn(line, " \t\r"));
+
+    char *words[2048];
+    int num_words = 0;
+    words[num_words++] = batch_file;
+
+    char *rest;
+    for (char *word = strtok_r(line, " \t\r", &rest); word && num_words < 2048; word = strtok_r(NULL, " \t\r", &rest))
+        words[num_words++] = word;
+
+    // a line can't run anything but a scene, so --batch starts out empty and has to stay so.
+    batch_file[0] = '\0';
+    apply_arguments(num_words, words);
+
+    if (batch_file[0] || resume_file[0] || play_file[0] || stats_file[0] || bench_frames)
+        PERROR("Scene %d, line %d: a scene of a batch is a new run of the physics, without --batch, --resume, --play, "
+            "--stats or --bench.", number, batch->line);
+
+    check_settings();
+
+    if (!scene_seed)
+        scene_seed = (int)(time(NULL) & INT32_MAX);
+
+    scene_settings(&batch->scene);
+    batch->last_frame = (uint64_t)num_seconds * (uint64_t)fps;
+
+    // a --record of the line's own is taken as it is, ours gets the number of the scene.
+    batch->record[0] = '\0';
+    if (record_file[0] && strcmp(record_file, our_record) != 0)
+        snprintf(batch->record, sizeof(batch->record), "%s", record_file);
+    else if (record_file[0])
+        numbered_path(batch->record, sizeof(batch->record), record_file, "scene", number);
+
+    restore_options(saved);
+    free(saved);
+}
+
+// bigger scenes first, so the last ones to finish are short.
+int compare_batch_work(const void *a, const void *b)
+{
+    const BatchScene *sa = a, *sb = b;
+    const uint64_t wa = (uint64_t)sa->scene.num_balls * sa->last_frame;
+    const uint64_t wb = (uint64_t)sb->scene.num_balls * sb->last_frame;
+    return (wa < wb) - (wa > wb);
+}
+
+// steps a scene of a batch through all of its frames, recording them if it is recorded.
+void run_batch_scene(BatchScene *batch)
+{
+    Scene *scene = &batch->scene;
+    const int64_t start_ns = schedule_now_ns();
+
+    alloc_scene(scene);
+    make_balls(scene, (uint64_t)scene->seed);
+
+    if (scene->event_driven)
+    {
+        start_events(scene);
+        events_load(&scene->events, scene->balls.x, scene->balls.y, scene->balls.vx, scene->balls.vy, 0.0);
+    }
+
+    if (batch->record[0])
+        start_trajectory(scene, batch->record, batch->last_frame);
+
+    for (uint64_t frame = 0; frame <= batch->last_frame; frame++)
+    {
+        update_positions(scene);
+
+        if (batch->record[0])
+            record_frame(scene, batch->record);
+    }
+
+    if (batch->record[0])
+        stop_trajectory(scene, batch->record, start_ns);
+
+    if (scene->event_driven)
+        events_stop(&scene->events);
+
+    const double seconds = (double)(schedule_now_ns() - start_ns) / 1e9;
+    printf("Scene of line %d, seed %d, %d balls, %" PRIu64 " frames in %.2f s, %.0f frames/s.\n", batch->line,
+        scene->seed, scene->num_balls, batch->last_frame + 1, seconds, (double)(batch->last_frame + 1) / seconds);
+
+    free_scene(scene);
+}
+
+/*
+runs every line of batch_file as a scene of its own, for sweeps of many small scenes that one at a time would leave
+most of the cores idle on. a line holds options on top of ours, and every scene is a Scene of its own with its own
+balls, grid, contacts and events, so scenes share nothing and each one steps exactly as it would in a run of its own.
+batch_jobs of them are stepped at once by an omp team, each with cpus / batch_jobs threads of its own, biggest first.
+a batch is physics only: nothing is drawn or checkpointed, and with --record every scene records to record_file with
+.scene<number> before its extension. blank lines and anything after a # are skipped. every line is checked before
+any scene starts.
+*/
+void run_batch()
+{
+    OPEN(fp, batch_file, "r");
+
+    BatchScene *scenes = NULL;
+    int num_scenes = 0;
+    char line[4096];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+        line[strcspn(line, "#\n")] = '\0';
+
+        if (line[strspn(line, " \t\r")] == '\0')
+            continue;
+
+        scenes = realloc(scenes, (size_t)(num_scenes + 1) * sizeof(BatchScene));
+        if (!scenes)
+            PERROR("Could not keep %d scenes.", num_scenes + 1);
+
+        scenes[num_scenes].line = line_number;
+        batch_line_settings(&scenes[num_scenes], num_scenes, line);
+        num_scenes++;
+    }
+
+    CLOSE(fp);
+
+    if (!num_scenes)
+        PERROR("%s has no scenes in it.", batch_file);
+
+    qsort(scenes, (size_t)num_scenes, sizeof(BatchScene), compare_batch_work);
+
+    const int cpus = omp_get_max_threads();
+    int jobs = batch_jobs ? batch_jobs : cpus;
+    if (jobs > num_scenes)
+        jobs = num_scenes;
+
+    // with more jobs than cpus, they take turns on them.
+    const int threads = cpus / jobs > 1 ? cpus / jobs : 1;
+
+    printf("Running %d scenes from %s, %d at a time with %d threads each.\n", num_scenes, batch_file, jobs, threads);
+
+    const int64_t start_ns = schedule_now_ns();
+    omp_set_max_active_levels(2);
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(jobs)
+    for (int s = 0; s < num_scenes; s++)
+    {
+        omp_set_num_threads(threads);
+        run_batch_scene(&scenes[s]);
+    }
+
+    const double seconds = (double)(schedule_now_ns() - start_ns) / 1e9;
+    printf("Ran %d scenes in %.1f s, %.0f scenes an hour.\n", num_scenes, seconds, num_scenes * 3600.0 / seconds);
+
+    free(scenes);
+}
+
+
+int main(int argc, char **argv)
+{
+    parse_arguments(argc, argv);
+
+    if (batch_file[0])
+    {
+        run_batch();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (play_file[0] && (resume_file[0] || record_file[0]))
+        PERROR("%s", "--play draws a recorded run, it doesn't go with --resume or --record.");
+
+    if (stats_file[0] && play_file[0])
+        PERROR("%s", "--stats is per simulated frame, it doesn't go with --play.");
+
+    if (num_segments > 1 && !play_file[0])
+        PERROR("%s", "--segments needs --play, the segments are drawn from a recorded trajectory.");
+
+    // a checkpoint brings settings of its own, which have to hold up as well as the ones on the command line.
+    if (resume_file[0])
+    {
+        open_checkpoint();
+        check_settings();
+    }
+
+    // playing back is offline, recording is physics only.
+    if (play_file[0])
+    {
+        open_trajectory();
+        show = false;
+    }
+
+    if (record_file[0])
+        render = show = false;
+
+    apply_settings();
+
+    if (bench_frames)
+    {
+        if (pin_threads)
+            pin_team("omp", 0, false);
+
+        run_benchmark(bench_frames);
+        exit(EXIT_SUCCESS);
+    }
+
+    // with segments, every segment starts its own ffmpeg.
+    const bool segmented = playback && render && num_segments > 1;
+
+    if (render && !segmented)
+        start_recording();
+
+
+    if (show)
+        setup_display();
+
+    if ((render || show) && !playback)
+        make_frames();
+
+    if (!resume && !playback && !scene_seed)
+        scene_seed = (int)(time(NULL) & INT32_MAX);
+
+    Scene *scene = &main_scene;
+    scene_settings(scene);
+
+    // before the first parallel region, so the omp threads inherit the hardware counters.
+#ifdef STATS
+    if (stats_file[0])
+        start_stats();
+#else
+    if (stats_file[0])
+        PERROR("%s", "--stats needs a build with STATS defined.");
+#endif
+
+    if (render && pipeline && !playback)
+        split_team();
+
+    if (pin_threads)
+        pin_team("omp", 0, false);
+
+    alloc_scene(scene);
+
+    if (playback)
+    {
+        play_colours();
+        play_sizes();
+
+        if (segmented)
+            play_segments();
+        else
+            play_trajectory();
+
+        if (render && !segmented)
+            stop_recording();
+
+        stop_playback();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (resume)
+    {
+        restore_checkpoint(scene);
+        printf("Seed %d, resuming at frame %" PRIu64 "\n", scene->seed, first_frame);
+    }
+    else
+    {
+        printf("Seed %d\n", scene->seed);
+
+        make_balls(scene, (uint64_t)scene->seed);
+
+        if (scene->event_driven)
+        {
+            start_events(scene);
+            events_load(&scene->events, scene->balls.x, scene->balls.y, scene->balls.vx, scene->balls.vy, (double)first_frame);
+        }
+    }
+
+    apply_draw_sizes(scene);
+
+    if (checkpoint_seconds)
+        start_checkpoints(scene);
+
+    if (record_file[0])
+        start_trajectory(scene, record_file, (uint64_t)num_seconds * (uint64_t)scene->fps);
+
+    if (render && pipeline)
+        start_pipeline();
+
+    simulate(scene);
+
+    if (render && pipeline)
+        stop_pipeline();
+
+    if (record_file[0])
+        stop_trajectory(scene, record_file, schedule.start_ns);
+    else
+        print_schedule();
+
+    if (scene->event_driven)
+        stop_events(scene);
+    else
+        print_neighbour_builds(scene);
+
+#ifdef STATS
+    if (stats_file[0])
+        stop_stats();
+#endif
+
+    if (checkpoint_seconds)
+        stop_checkpoints();
+
+    if (show)
+        close_display();
+
+    if (render)
+        stop_recording();
+
+    if (render || show)
+        free_frames();
+
+    exit(EXIT_SUCCESS);
+}
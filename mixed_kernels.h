@@ -0,0 +1,257 @@
+/*
+the broad phase and the collisions for balls of mixed sizes, used when ball_size_max is past ball_size.
+every ball has its own size, and a mass that goes with its area, so a collision pushes two balls apart and changes
+their velocities in inverse proportion to their masses. two balls of one size split both in half, as they do in physics_kernels.h.
+
+one grid with cells as wide as the biggest ball would put hundreds of small balls in every cell, and one as wide as
+the smallest would have the big balls search hundreds of cells. so every ball sits in the grid of its size level,
+see MAX_SIZE_LEVELS, and searches its own level and the levels of the bigger balls, skipping the ones without any.
+the cells of a level are at least as wide as its balls, so that is 3x3 cells a level, 4x4 at worst. the levels of the
+small balls in a world taken up by big ones wrap around, so no level has many more slots than balls or 4 rows. a pair of two
+levels is found by the smaller ball, a pair of one level by the ball with the lower index.
+
+included once by main.c, after the grid, the contact lists and the helpers it shares with physics_kernels.h, and
+before the copy of physics_kernels.h with KERNEL_MIXED_SIZES, which integrates the balls and resolves the contacts.
+*/
+
+
+
+
+// pushes i and j apart and bounces them off each other. true when they were approaching and got an impulse.
+static inline bool handle_collision_mixed(Scene *scene, const int i, const int j)
+{
+    const float ri = scene->balls.size[i] * 0.5f;
+    const float rj = scene->balls.size[j] * 0.5f;
+    const float reach = ri + rj;
+
+    float dx = (scene->balls.x[i] + ri) - (scene->balls.x[j] + rj);
+    float dy = (scene->balls.y[i] + ri) - (scene->balls.y[j] + rj);
+
+    if (dx * dx + dy * dy >= reach * reach + EPSILON)
+        return false;
+
+    float dist = sqrtf(dx * dx + dy * dy);
+
+    // just in case the two circles are perfectly overlapping.
+    if (dist < 1e-6f)
+    {
+        dx = 1.0f;
+        dy = 0.0f;
+        dist = 1.0f;
+    }
+
+    const float nx = dx / dist;
+    const float ny = dy / dist;
+
+    // the lighter ball takes the bigger share of both the push and the impulse.
+    const float share_i = scene->balls.mass[j] / (scene->balls.mass[i] + scene->balls.mass[j]);
+    const float share_j = scene->balls.mass[i] / (scene->balls.mass[i] + scene->balls.mass[j]);
+
+    const float overlap = reach - dist;
+
+    scene->balls.x[i] += nx * overlap * share_i;
+    scene->balls.y[i] += ny * overlap * share_i;
+    scene->balls.x[j] -= nx * overlap * share_j;
+    scene->balls.y[j] -= ny * overlap * share_j;
+
+    const float rvx = scene->balls.vx[i] - scene->balls.vx[j];
+    const float rvy = scene->balls.vy[i] - scene->balls.vy[j];
+    const float velAlongNormal = rvx * nx + rvy * ny;
+
+    if (velAlongNormal < 0.0f)
+    {
+        // the impulse over the reduced mass, -(1 + e) * vn * mi * mj / (mi + mj), divided by each ball's own mass.
+        const float restitution = 1.0f;
+        const float impulse = -(1.0f + restitution) * velAlongNormal;
+
+        scene->balls.vx[i] += impulse * share_i * nx;
+        scene->balls.vy[i] += impulse * share_i * ny;
+        scene->balls.vx[j] -= impulse * share_j * nx;
+        scene->balls.vy[j] -= impulse * share_j * ny;
+        return true;
+    }
+
+    return false;
+}
+
+// counting sort of the balls into the cells of their levels by centre. balls inside a cell stay in index order.
+static inline void build_grid_mixed(Scene *scene)
+{
+    memset(scene->cell_start, 0, (size_t)(scene->grid_cells + 1) * sizeof(int));
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        const float r = scene->balls.size[i] * 0.5f;
+        scene->ball_cell[i] = level_cell_of(scene, scene->ball_level[i], scene->balls.x[i] + r, scene->balls.y[i] + r);
+        scene->cell_start[scene->ball_cell[i] + 1]++;
+    }
+
+    for (int c = 0; c < scene->grid_cells; c++)
+        scene->cell_start[c + 1] += scene->cell_start[c];
+
+    memcpy(scene->cell_fill, scene->cell_start, (size_t)scene->grid_cells * sizeof(int));
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        const float r = scene->balls.size[i] * 0.5f;
+        const int k = scene->cell_fill[scene->ball_cell[i]]++;
+        scene->cell_balls[k] = i;
+        scene->cell_x[k] = scene->balls.x[i] + r;
+        scene->cell_y[k] = scene->balls.y[i] + r;
+        scene->cell_r[k] = r;
+    }
+}
+
+#ifdef VERIFY_BROAD_PHASE
+// the overlapping pairs found by an all-pairs loop and by the levels have to be the same.
+static inline void verify_broad_phase_mixed(Scene *scene)
+{
+    const int max_pairs = scene->num_balls * 8;
+    uint64_t *all_pairs = MALLOC((size_t)max_pairs * sizeof(uint64_t));
+    uint64_t *grid_pairs = MALLOC((size_t)max_pairs * sizeof(uint64_t));
+    float *cx = MALLOC((size_t)scene->num_balls * sizeof(float));
+    float *cy = MALLOC((size_t)scene->num_balls * sizeof(float));
+    float *r = MALLOC((size_t)scene->num_balls * sizeof(float));
+    int num_all = 0, num_grid = 0;
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        r[i] = scene->balls.size[i] * 0.5f;
+        cx[i] = scene->balls.x[i] + r[i];
+        cy[i] = scene->balls.y[i] + r[i];
+    }
+
+    // same distance kernel as the levels, so only the pair search itself is being compared.
+    for (int i = 0; i < scene->num_balls; i++)
+        for (int j = i + 1; j < scene->num_balls; j += SIMD_WIDTH)
+        {
+            uint32_t hits = overlap_mask_radii(cx[i], cy[i], r[i], cx + j, cy + j, r + j,
+                                               scene->num_balls - j < SIMD_WIDTH ? scene->num_balls - j : SIMD_WIDTH, EPSILON);
+            while (hits)
+            {
+                if (num_all == max_pairs)
+                    PERROR("%s", "Too many overlapping pairs to verify.");
+                all_pairs[num_all++] = ((uint64_t)i << 32) | (uint64_t)(j + __builtin_ctz(hits));
+                hits &= hits - 1;
+            }
+        }
+
+    if (scene->found_contacts.count > max_pairs)
+        PERROR("%s", "Too many overlapping pairs to verify.");
+
+    for (int k = 0; k < scene->found_contacts.count; k++)
+        grid_pairs[num_grid++] = ((uint64_t)scene->found_contacts.contacts[k].a << 32) | (uint64_t)scene->found_contacts.contacts[k].b;
+
+    check_broad_phase(all_pairs, num_all, grid_pairs, num_grid);
+
+    free(all_pairs);
+    free(grid_pairs);
+    free(cx);
+    free(cy);
+    free(r);
+}
+#endif
+
+// finds every overlapping pair into found_contacts, lower index first. blocked and joined like find_pairs,
+// so the list is the same whatever the thread count. the balls are taken in the order of the grid, not by index,
+// so the cells the next ball searches are mostly still in the cache.
+static inline void find_contacts_mixed(Scene *scene)
+{
+    const bool parallel = scene->num_balls >= PARALLEL_MIN_CONTACT_BALLS;
+    const int num_blocks = parallel ? omp_get_max_threads() * CONTACT_BLOCKS_PER_THREAD : 1;
+
+    reserve_block_contacts(scene, num_blocks);
+
+    #pragma omp parallel if(parallel)
+    {
+        STAT_LOCAL(pair_tests);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < num_blocks; block++)
+        {
+            const int first = (int)((int64_t)scene->num_balls * block / num_blocks);
+            const int last = (int)((int64_t)scene->num_balls * (block + 1) / num_blocks);
+
+            ContactList *list = &scene->block_contacts[block];
+            list->count = 0;
+
+            for (int q = first; q < last; q++)
+            {
+                const int i = scene->cell_balls[q];
+                const float cx = scene->cell_x[q];
+                const float cy = scene->cell_y[q];
+                const float r = scene->cell_r[q];
+
+                for (int level = scene->ball_level[i]; level < scene->num_levels; level++)
+                {
+                    if (!scene->level_balls[level])
+                        continue;
+
+                    const bool own_level = level == scene->ball_level[i];
+                    int col0, col1, row0, row1;
+                    level_span(scene, level, cx, r, scene->level_cols[level], &col0, &col1);
+                    level_span(scene, level, cy, r, scene->level_rows[level], &row0, &row1);
+
+                    // the slots of a row are contiguous, so each row is tested a vector at a time. on a hashed level
+                    // the row can wrap around the end of the level's slots, then it is two runs. the next row is
+                    // a row of slots further on, wrapped the same way, which saves level_slot its division.
+                    const int end = scene->level_first[level + 1];
+                    int slot0 = level_slot(scene, level, col0, row0);
+
+                    for (int row = row0; row <= row1; row++)
+                    {
+                        int slot1 = slot0 + (col1 - col0);
+                        if (slot1 >= end)
+                            slot1 -= scene->level_slots[level];
+
+                        const int runs[2][2] = {
+                            {slot0, slot0 <= slot1 ? slot1 : end - 1},
+                            {scene->level_first[level], slot0 <= slot1 ? scene->level_first[level] - 1 : slot1},
+                        };
+
+                        slot0 += scene->level_cols[level];
+                        if (slot0 >= end)
+                            slot0 -= scene->level_slots[level];
+
+                        for (int run = 0; run < 2; run++)
+                        {
+                            const int run_end = scene->cell_start[runs[run][1] + 1];
+
+                            for (int k = scene->cell_start[runs[run][0]]; k < run_end; k += SIMD_WIDTH)
+                            {
+                                const int n = run_end - k < SIMD_WIDTH ? run_end - k : SIMD_WIDTH;
+                                STAT_ADD_LOCAL(pair_tests, n);
+
+                                uint32_t hits = overlap_mask_radii(cx, cy, r, scene->cell_x + k, scene->cell_y + k, scene->cell_r + k, n, EPSILON);
+                                while (hits)
+                                {
+                                    const int j = scene->cell_balls[k + __builtin_ctz(hits)];
+                                    hits &= hits - 1;
+
+                                    if (!own_level || j > i)
+                                        PUSH_CONTACT(list, i < j ? i : j, i < j ? j : i)
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        STAT_COUNT(COUNT_PAIR_TESTS, pair_tests);
+        join_block_contacts(scene, &scene->found_contacts, num_blocks);
+    }
+}
+
+void broad_phase_mixed(Scene *scene)
+{
+    build_grid_mixed(scene);
+    find_contacts_mixed(scene);
+
+    scene->broad_phases++;
+    STAT_COUNT(COUNT_OVERLAPS, scene->found_contacts.count);
+
+    #ifdef VERIFY_BROAD_PHASE
+    verify_broad_phase_mixed(scene);
+    #endif
+}
@@ -0,0 +1,361 @@
+/*
+the per frame physics, written once and compiled for several ball sizes.
+
+include this file after defining
+    KERNEL_SUFFIX       appended to every function name: integrate_balls_40, broad_phase_40, ...
+    KERNEL_BALL_SIZE    a literal like 40 for a specialised copy, or scene->ball_size for the copy that takes any size.
+    KERNEL_MIXED_SIZES  instead of KERNEL_BALL_SIZE, every ball has its own size and mass. only the integration and
+                        the narrow phase come from here then, the broad phase is the level grid of mixed_kernels.h.
+
+a literal size is folded into every loop, including the bodies the omp pragmas outline, which a
+size passed as an argument would not be. main.c picks the copy that matches a scene when it is made, and every
+function takes the scene it works on.
+there is no include guard on purpose.
+*/
+
+#define KERNEL_PASTE_(name, suffix) name##_##suffix
+#define KERNEL_PASTE(name, suffix) KERNEL_PASTE_(name, suffix)
+#define KERNEL(name) KERNEL_PASTE(name, KERNEL_SUFFIX)
+
+// what resolving a contact and moving a run of balls along one axis come down to.
+#ifdef KERNEL_MIXED_SIZES
+#define KERNEL_HANDLE_COLLISION(i, j) handle_collision_mixed(scene, i, j)
+#define KERNEL_INTEGRATE_SPAN(position, velocity, first, last, wall) \
+    integrate_span_sizes(position, velocity, scene->balls.size, first, last, wall)
+#else
+#define KERNEL_HANDLE_COLLISION(i, j) KERNEL(handle_collision)(scene, i, j)
+#define KERNEL_INTEGRATE_SPAN(position, velocity, first, last, wall) \
+    integrate_span(position, velocity, first, last, (float)KERNEL_BALL_SIZE, wall)
+#endif
+
+#define KERNEL_OVERLAP ((float)(KERNEL_BALL_SIZE * KERNEL_BALL_SIZE) + EPSILON)
+
+// neighbours are balls within a ball size plus the skin of each other.
+#define KERNEL_NEIGHBOUR_LIMIT ((float)((KERNEL_BALL_SIZE + scene->neighbour_skin) * (KERNEL_BALL_SIZE + scene->neighbour_skin)) + EPSILON)
+
+
+
+
+#ifndef KERNEL_MIXED_SIZES
+static inline bool KERNEL(is_overlapping)(const Scene *scene, const int a, const int b)
+{
+    const float dx = scene->balls.x[a] - scene->balls.x[b];
+    const float dy = scene->balls.y[a] - scene->balls.y[b];
+    return dx * dx + dy * dy < KERNEL_OVERLAP;
+}
+
+// pushes i and j apart and bounces them off each other. true when they were approaching and got an impulse.
+static inline bool KERNEL(handle_collision)(Scene *scene, const int i, const int j)
+{
+    if (!KERNEL(is_overlapping)(scene, i, j))
+        return false;
+
+    float dx = scene->balls.x[i] - scene->balls.x[j];
+    float dy = scene->balls.y[i] - scene->balls.y[j];
+    float dist = sqrtf(dx * dx + dy * dy);
+
+    // just in case the two circles are perfectly overlapping.
+    if (dist < 1e-6f)
+    {
+        dx = 1.0f;
+        dy = 0.0f;
+        dist = 1.0f;
+    }
+
+    const float nx = dx / dist;
+    const float ny = dy / dist;
+
+    // --- Positional correction only ---
+    const float overlap = (float)KERNEL_BALL_SIZE - dist;
+    const float separation = overlap / 2.0f;
+
+    scene->balls.x[i] += nx * separation;
+    scene->balls.y[i] += ny * separation;
+    scene->balls.x[j] -= nx * separation;
+    scene->balls.y[j] -= ny * separation;
+
+    // --- Velocity bounce only if approaching ---
+    const float rvx = scene->balls.vx[i] - scene->balls.vx[j];
+    const float rvy = scene->balls.vy[i] - scene->balls.vy[j];
+    const float velAlongNormal = rvx * nx + rvy * ny;
+
+    if (velAlongNormal < 0.0f)
+    {
+        const float restitution = 1.0f;
+        const float impulse = -(1.0f + restitution) * velAlongNormal / 2.0f;
+
+        const float impulseX = impulse * nx;
+        const float impulseY = impulse * ny;
+
+        scene->balls.vx[i] += impulseX;
+        scene->balls.vy[i] += impulseY;
+        scene->balls.vx[j] -= impulseX;
+        scene->balls.vy[j] -= impulseY;
+        return true;
+    }
+
+    return false;
+}
+
+static inline int KERNEL(cell_of)(const Scene *scene, const float x, const float y)
+{
+    int col = (int)(x / (float)scene->grid_cell_size);
+    int row = (int)(y / (float)scene->grid_cell_size);
+
+    // balls can be pushed slightly past the walls by a collision.
+    if (col < 0) col = 0;
+    if (row < 0) row = 0;
+    if (col >= scene->grid_cols) col = scene->grid_cols - 1;
+    if (row >= scene->grid_rows) row = scene->grid_rows - 1;
+
+    return row * scene->grid_cols + col;
+}
+
+// counting sort of the balls into the grid. balls inside a cell stay in index order.
+static inline void KERNEL(build_grid)(Scene *scene)
+{
+    memset(scene->cell_start, 0, (size_t)(scene->grid_cells + 1) * sizeof(int));
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        scene->ball_cell[i] = KERNEL(cell_of)(scene, scene->balls.x[i], scene->balls.y[i]);
+        scene->cell_start[scene->ball_cell[i] + 1]++;
+    }
+
+    for (int c = 0; c < scene->grid_cells; c++)
+        scene->cell_start[c + 1] += scene->cell_start[c];
+
+    memcpy(scene->cell_fill, scene->cell_start, (size_t)scene->grid_cells * sizeof(int));
+
+    for (int i = 0; i < scene->num_balls; i++)
+    {
+        const int k = scene->cell_fill[scene->ball_cell[i]]++;
+        scene->cell_balls[k] = i;
+        scene->cell_x[k] = scene->balls.x[i];
+        scene->cell_y[k] = scene->balls.y[i];
+    }
+}
+
+#ifdef VERIFY_BROAD_PHASE
+// the overlapping pairs found by the old all-pairs loop and by the broad phase have to be the same.
+static inline void KERNEL(verify_broad_phase)(Scene *scene)
+{
+    const int max_pairs = scene->num_balls * 8;
+    uint64_t *all_pairs = MALLOC((size_t)max_pairs * sizeof(uint64_t));
+    uint64_t *grid_pairs = MALLOC((size_t)max_pairs * sizeof(uint64_t));
+    int num_all = 0, num_grid = 0;
+
+    #define ADD_PAIR(list, count, i, j)\
+    {\
+        if (count == max_pairs) PERROR("%s", "Too many overlapping pairs to verify.");\
+        list[count++] = ((uint64_t)(i) << 32) | (uint64_t)(j);\
+    }
+
+    // same distance kernel as the grid, so only the pair search itself is being compared.
+    for (int i = 0; i < scene->num_balls; i++)
+        for (int j = i + 1; j < scene->num_balls; j += SIMD_WIDTH)
+        {
+            uint32_t hits = overlap_mask(scene->balls.x[i], scene->balls.y[i], scene->balls.x + j, scene->balls.y + j,
+                                         scene->num_balls - j < SIMD_WIDTH ? scene->num_balls - j : SIMD_WIDTH, KERNEL_OVERLAP);
+            while (hits)
+            {
+                ADD_PAIR(all_pairs, num_all, i, j + __builtin_ctz(hits))
+                hits &= hits - 1;
+            }
+        }
+
+    #undef ADD_PAIR
+
+    if (scene->found_contacts.count > max_pairs)
+        PERROR("%s", "Too many overlapping pairs to verify.");
+
+    for (int k = 0; k < scene->found_contacts.count; k++)
+        grid_pairs[num_grid++] = ((uint64_t)scene->found_contacts.contacts[k].a << 32) | (uint64_t)scene->found_contacts.contacts[k].b;
+
+    check_broad_phase(all_pairs, num_all, grid_pairs, num_grid);
+
+    free(all_pairs);
+    free(grid_pairs);
+}
+#endif
+
+// finds every pair of balls closer than sqrt(limit) into pairs.
+// the balls are cut into blocks, which threads take as they come free and collect the pairs of into their own list.
+// the lists are joined in block order, so the result is the same list the serial loop would find, whatever the thread count.
+// sorted puts the pairs of every ball in partner order instead of the order of the cells they were in.
+static inline void KERNEL(find_pairs)(Scene *scene, const float limit, const bool sorted, ContactList *pairs)
+{
+    const bool parallel = scene->num_balls >= PARALLEL_MIN_CONTACT_BALLS;
+    const int num_blocks = parallel ? omp_get_max_threads() * CONTACT_BLOCKS_PER_THREAD : 1;
+
+    reserve_block_contacts(scene, num_blocks);
+
+    #pragma omp parallel if(parallel)
+    {
+        STAT_LOCAL(pair_tests);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < num_blocks; block++)
+        {
+            const int first = (int)((int64_t)scene->num_balls * block / num_blocks);
+            const int last = (int)((int64_t)scene->num_balls * (block + 1) / num_blocks);
+
+            ContactList *list = &scene->block_contacts[block];
+            list->count = 0;
+
+            #define PUSH_BLOCK_CONTACT(i, j) PUSH_CONTACT(list, i, j)
+            #define COUNT_TESTS(n) STAT_ADD_LOCAL(pair_tests, n)
+            FOR_EACH_GRID_OVERLAP_IN(first, last, limit, PUSH_BLOCK_CONTACT, COUNT_TESTS)
+            #undef COUNT_TESTS
+            #undef PUSH_BLOCK_CONTACT
+
+            if (sorted)
+                sort_partners(list);
+        }
+
+        STAT_COUNT(COUNT_PAIR_TESTS, pair_tests);
+        join_block_contacts(scene, pairs, num_blocks);
+    }
+}
+
+// the neighbour pairs that overlap now, in neighbour list order. blocked and joined like find_pairs.
+static inline void KERNEL(filter_neighbours)(Scene *scene)
+{
+    const bool parallel = scene->neighbour_pairs.count >= PARALLEL_MIN_NEIGHBOUR_PAIRS;
+    const int num_blocks = parallel ? omp_get_max_threads() * CONTACT_BLOCKS_PER_THREAD : 1;
+
+    reserve_block_contacts(scene, num_blocks);
+    STAT_COUNT(COUNT_PAIR_TESTS, scene->neighbour_pairs.count);
+
+    #pragma omp parallel if(parallel)
+    {
+        #pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < num_blocks; block++)
+        {
+            const int first = (int)((int64_t)scene->neighbour_pairs.count * block / num_blocks);
+            const int last = (int)((int64_t)scene->neighbour_pairs.count * (block + 1) / num_blocks);
+
+            ContactList *list = &scene->block_contacts[block];
+            list->count = 0;
+
+            for (int k = first; k < last; k++)
+            {
+                const Contact pair = scene->neighbour_pairs.contacts[k];
+                if (KERNEL(is_overlapping)(scene, pair.a, pair.b))
+                    PUSH_CONTACT(list, pair.a, pair.b)
+            }
+        }
+
+        join_block_contacts(scene, &scene->found_contacts, num_blocks);
+    }
+}
+
+// the pairs within a ball size plus the skin of each other, and where every ball was when they were found.
+// sorted so the contacts filtered out of them don't depend on which frame the list was built on, a resumed run
+// builds it on a different frame than the run it carries on from.
+static inline void KERNEL(build_neighbours)(Scene *scene)
+{
+    KERNEL(build_grid)(scene);
+    KERNEL(find_pairs)(scene, KERNEL_NEIGHBOUR_LIMIT, true, &scene->neighbour_pairs);
+
+    memcpy(scene->built_x, scene->balls.x, (size_t)scene->num_balls * sizeof(float));
+    memcpy(scene->built_y, scene->balls.y, (size_t)scene->num_balls * sizeof(float));
+    scene->neighbours_built = true;
+    scene->neighbour_builds++;
+    STAT_COUNT(COUNT_NEIGHBOUR_BUILDS, 1);
+}
+#endif
+
+static inline void KERNEL(resolve_contacts)(Scene *scene)
+{
+    // no ball is in two contacts of one colour, so the order they are resolved in within a colour doesn't matter.
+    #pragma omp parallel if(scene->coloured_contacts.count >= PARALLEL_MIN_CONTACTS)
+    {
+        STAT_LOCAL(impulses);
+
+        for (int colour = 0; colour < MAX_COLOURS; colour++)
+        {
+            #pragma omp for schedule(dynamic, 64)
+            for (int k = scene->colour_start[colour]; k < scene->colour_start[colour + 1]; k++)
+                STAT_ADD_LOCAL(impulses, KERNEL_HANDLE_COLLISION(scene->coloured_contacts.contacts[k].a, scene->coloured_contacts.contacts[k].b));
+        }
+
+        #pragma omp single
+        for (int k = scene->colour_start[MAX_COLOURS]; k < scene->colour_start[MAX_COLOURS + 1]; k++)
+            STAT_ADD_LOCAL(impulses, KERNEL_HANDLE_COLLISION(scene->coloured_contacts.contacts[k].a, scene->coloured_contacts.contacts[k].b));
+
+        STAT_COUNT(COUNT_IMPULSES, impulses);
+    }
+}
+
+
+
+
+void KERNEL(integrate_balls)(Scene *scene)
+{
+    #pragma omp parallel if(scene->num_balls >= PARALLEL_MIN_BALLS)
+    {
+        STAT_LOCAL(bounces);
+
+        // blocks of 16 keep every thread's first ball on an aligned vector.
+        #pragma omp for schedule(static)
+        for (int block = 0; block < SIMD_PAD(scene->num_balls) / 16; block++)
+        {
+            const int first = block * 16;
+            const int last = first + 16 < scene->num_balls ? first + 16 : scene->num_balls;
+
+            STAT_ADD_LOCAL(bounces, KERNEL_INTEGRATE_SPAN(scene->balls.x, scene->balls.vx, first, last, (float)scene->world_width));
+            STAT_ADD_LOCAL(bounces, KERNEL_INTEGRATE_SPAN(scene->balls.y, scene->balls.vy, first, last, (float)scene->world_height));
+        }
+
+        STAT_COUNT(COUNT_WALL_BOUNCES, bounces);
+    }
+}
+
+#ifndef KERNEL_MIXED_SIZES
+// with a skin the contacts come out of the neighbour lists, which are only built again once a ball could have
+// crossed the skin. without one they come straight from the grid every frame, sorted like the neighbour lists so
+// both resolve the same contacts in the same order and the skin only changes how fast they are found.
+void KERNEL(broad_phase)(Scene *scene)
+{
+    if (scene->neighbour_skin > 0)
+    {
+        if (neighbours_stale(scene))
+            KERNEL(build_neighbours)(scene);
+
+        KERNEL(filter_neighbours)(scene);
+    }
+    else
+    {
+        KERNEL(build_grid)(scene);
+        KERNEL(find_pairs)(scene, KERNEL_OVERLAP, true, &scene->found_contacts);
+    }
+
+    scene->broad_phases++;
+    STAT_COUNT(COUNT_OVERLAPS, scene->found_contacts.count);
+
+    #ifdef VERIFY_BROAD_PHASE
+    KERNEL(verify_broad_phase)(scene);
+    #endif
+}
+#endif
+
+void KERNEL(narrow_phase)(Scene *scene)
+{
+    colour_contacts(scene);
+    KERNEL(resolve_contacts)(scene);
+}
+
+
+
+
+#undef KERNEL_INTEGRATE_SPAN
+#undef KERNEL_HANDLE_COLLISION
+#undef KERNEL_MIXED_SIZES
+#undef KERNEL_NEIGHBOUR_LIMIT
+#undef KERNEL_OVERLAP
+#undef KERNEL
+#undef KERNEL_PASTE
+#undef KERNEL_PASTE_
+#undef KERNEL_SUFFIX
+#undef KERNEL_BALL_SIZE
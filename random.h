@@ -0,0 +1,48 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/*
+counter based random numbers. a stream is a key and a counter, and every number is a hash of the two,
+so any thread can draw from any stream without locks and the n-th number of a stream is always the same.
+give every ball its own stream and the results don't depend on the thread count or the order of the work.
+*/
+
+
+
+
+typedef struct
+{
+    uint64_t key;
+    uint64_t counter;
+} RandomStream;
+
+
+
+
+// splitmix64 finaliser. a bijection, so different inputs never share an output.
+static inline uint64_t random_mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline RandomStream random_stream(const uint64_t seed, const uint64_t stream)
+{
+    return (RandomStream){random_mix(random_mix(seed) + stream * 0x9E3779B97F4A7C15ull), 0};
+}
+
+static inline uint64_t random_next(RandomStream *stream)
+{
+    return random_mix(stream->key + stream->counter++ * 0x9E3779B97F4A7C15ull);
+}
+
+// uniform in [0, 1).
+static inline float random_float(RandomStream *stream)
+{
+    return (float)(random_next(stream) >> 40) * 0x1.0p-24f;
+}
+
+#endif
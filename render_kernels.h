@@ -0,0 +1,415 @@
+/*
+the frame rasterizer, written once and compiled for several ball sizes and resolutions.
+
+include this file after defining
+    KERNEL_SUFFIX        appended to every function name: render_frame_40_1920x1080, ...
+    KERNEL_BALL_SIZE     a literal size balls are drawn at, or draw_size for any size.
+    KERNEL_MIXED_SIZES   instead of KERNEL_BALL_SIZE, every ball is drawn at its own size out of draw_sizes.
+    KERNEL_FRAME_WIDTH   a literal frame width, or frame_width.
+    KERNEL_FRAME_HEIGHT  a literal frame height, or frame_height.
+
+see physics_kernels.h for why these are literals rather than arguments. a frame draws the balls of a Shown, which
+are looked up by their place k in it, ball i = shown->balls[k].
+there is no include guard on purpose.
+*/
+
+#define KERNEL_PASTE_(name, suffix) name##_##suffix
+#define KERNEL_PASTE(name, suffix) KERNEL_PASTE_(name, suffix)
+#define KERNEL(name) KERNEL_PASTE(name, KERNEL_SUFFIX)
+
+// the size ball i is drawn at and the half widths of its rows, see ball_spans.
+#ifdef KERNEL_MIXED_SIZES
+#define KERNEL_SIZE_OF(i) draw_sizes[i]
+#define KERNEL_SPANS_OF(i) (radius_spans + radius_start[draw_sizes[i] / 2])
+#else
+#define KERNEL_SIZE_OF(i) KERNEL_BALL_SIZE
+#define KERNEL_SPANS_OF(i) ball_spans
+#endif
+
+#define KERNEL_RADIUS_OF(i) (KERNEL_SIZE_OF(i) / 2)
+#define KERNEL_TILE_COLS ((KERNEL_FRAME_WIDTH + TILE_WIDTH - 1) / TILE_WIDTH)
+#define KERNEL_TILE_ROWS ((KERNEL_FRAME_HEIGHT + TILE_HEIGHT - 1) / TILE_HEIGHT)
+#define KERNEL_NUM_TILES (KERNEL_TILE_COLS * KERNEL_TILE_ROWS)
+
+
+
+
+// the pixels a ball of radius centred on (cx, cy) can cover, clipped to the frame. false when the ball is entirely off the frame.
+static inline bool KERNEL(centre_box)(const int cx, const int cy, const int radius, Rect *box)
+{
+    box->x0 = cx - radius < 0 ? 0 : cx - radius;
+    box->y0 = cy - radius < 0 ? 0 : cy - radius;
+    box->x1 = cx + radius + 1 > KERNEL_FRAME_WIDTH ? KERNEL_FRAME_WIDTH : cx + radius + 1;
+    box->y1 = cy + radius + 1 > KERNEL_FRAME_HEIGHT ? KERNEL_FRAME_HEIGHT : cy + radius + 1;
+
+    return box->x0 < box->x1 && box->y0 < box->y1;
+}
+
+// pixel ball i with its top left corner at coord is centred on, along one axis. rounded down rather than towards 0,
+// coord goes negative for the balls past the left or top edge of the camera, and those would be drawn a pixel off.
+static inline int KERNEL(centre_of)(const float coord, const int i)
+{
+    (void)i;
+    return (int)floorf(coord + (float)KERNEL_SIZE_OF(i) / 2.0f);
+}
+
+static inline bool KERNEL(ball_box)(const Shown *shown, const int k, Rect *box)
+{
+    const int i = shown->balls[k];
+    return KERNEL(centre_box)(KERNEL(centre_of)(shown->x[k], i), KERNEL(centre_of)(shown->y[k], i), KERNEL_RADIUS_OF(i), box);
+}
+
+// draws the part of shown ball k that falls inside clip. returns the number of pixels written.
+static inline int KERNEL(draw_ball_rgb)(uint8_t *rgb_buffer, const Shown *shown, const int k, const Rect clip)
+{
+    const int i = shown->balls[k];
+    const int cx = KERNEL(centre_of)(shown->x[k], i);
+    const int cy = KERNEL(centre_of)(shown->y[k], i);
+    int pixels = 0;
+
+    uint8_t pattern[48];
+    for (int p = 0; p < 16; p++)
+    {
+        pattern[p * 3 + 0] = (uint8_t)(main_scene.balls.color[i] >> 16);
+        pattern[p * 3 + 1] = (uint8_t)(main_scene.balls.color[i] >> 8);
+        pattern[p * 3 + 2] = (uint8_t)main_scene.balls.color[i];
+    }
+
+    const int radius = KERNEL_RADIUS_OF(i);
+    const int *spans = KERNEL_SPANS_OF(i);
+    const int row0 = cy - radius < clip.y0 ? clip.y0 : cy - radius;
+    const int row1 = cy + radius >= clip.y1 ? clip.y1 - 1 : cy + radius;
+
+    for (int py = row0; py <= row1; py++)
+    {
+        const int half_width = spans[py - cy + radius];
+        const int px0 = cx - half_width < clip.x0 ? clip.x0 : cx - half_width;
+        const int px1 = cx + half_width >= clip.x1 ? clip.x1 - 1 : cx + half_width;
+
+        if (px0 <= px1)
+        {
+            fill_rgb_span(rgb_buffer + ((size_t)py * (size_t)KERNEL_FRAME_WIDTH + (size_t)px0) * 3, px1 - px0 + 1, pattern);
+            pixels += px1 - px0 + 1;
+        }
+    }
+
+    return pixels;
+}
+
+// draws the part of shown ball k inside clip into the Y plane, and into full resolution chroma for the tile at
+// (tile_x, tile_y), which redraw_rect_yuv then averages down. returns the number of pixels written.
+static inline int KERNEL(draw_ball_yuv)(uint8_t *y_plane, uint8_t chroma_u[TILE_HEIGHT][TILE_WIDTH], uint8_t chroma_v[TILE_HEIGHT][TILE_WIDTH],
+                                        const int tile_x, const int tile_y, const Shown *shown, const int k, const Rect clip)
+{
+    const int i = shown->balls[k];
+    const int cx = KERNEL(centre_of)(shown->x[k], i);
+    const int cy = KERNEL(centre_of)(shown->y[k], i);
+    const uint8_t y = (uint8_t)(main_scene.balls.yuv[i] >> 16);
+    const uint8_t u = (uint8_t)(main_scene.balls.yuv[i] >> 8);
+    const uint8_t v = (uint8_t)main_scene.balls.yuv[i];
+    int pixels = 0;
+
+    const int radius = KERNEL_RADIUS_OF(i);
+    const int *spans = KERNEL_SPANS_OF(i);
+    const int row0 = cy - radius < clip.y0 ? clip.y0 : cy - radius;
+    const int row1 = cy + radius >= clip.y1 ? clip.y1 - 1 : cy + radius;
+
+    for (int py = row0; py <= row1; py++)
+    {
+        const int half_width = spans[py - cy + radius];
+        const int px0 = cx - half_width < clip.x0 ? clip.x0 : cx - half_width;
+        const int px1 = cx + half_width >= clip.x1 ? clip.x1 - 1 : cx + half_width;
+
+        if (px0 <= px1)
+        {
+            memset(y_plane + (size_t)py * (size_t)KERNEL_FRAME_WIDTH + (size_t)px0, y, (size_t)(px1 - px0 + 1));
+            memset(&chroma_u[py - tile_y][px0 - tile_x], u, (size_t)(px1 - px0 + 1));
+            memset(&chroma_v[py - tile_y][px0 - tile_x], v, (size_t)(px1 - px0 + 1));
+            pixels += px1 - px0 + 1;
+        }
+    }
+
+    return pixels;
+}
+
+static inline Rect KERNEL(tile_rect)(const int t)
+{
+    const int tx = t % KERNEL_TILE_COLS;
+    const int ty = t / KERNEL_TILE_COLS;
+
+    return (Rect){
+        tx * TILE_WIDTH,
+        ty * TILE_HEIGHT,
+        (tx + 1) * TILE_WIDTH > KERNEL_FRAME_WIDTH ? KERNEL_FRAME_WIDTH : (tx + 1) * TILE_WIDTH,
+        (ty + 1) * TILE_HEIGHT > KERNEL_FRAME_HEIGHT ? KERNEL_FRAME_HEIGHT : (ty + 1) * TILE_HEIGHT,
+    };
+}
+
+// counting sort of the shown balls into every tile they touch, by their place in shown. scanning them in order keeps
+// each bin in index order, which is the painter's order: later balls draw on top.
+static inline void KERNEL(bin_balls)(TileBins *bins, const Shown *shown)
+{
+    memset(bins->tile_start, 0, (size_t)(KERNEL_NUM_TILES + 1) * sizeof(int));
+
+    for (int k = 0; k < shown->count; k++)
+    {
+        Rect box;
+        if (KERNEL(ball_box)(shown, k, &box))
+            FOR_EACH_TILE_IN(box, KERNEL_TILE_COLS, t)
+                bins->tile_start[t + 1]++;
+    }
+
+    for (int t = 0; t < KERNEL_NUM_TILES; t++)
+        bins->tile_start[t + 1] += bins->tile_start[t];
+
+    if (bins->tile_balls_capacity < bins->tile_start[KERNEL_NUM_TILES])
+    {
+        bins->tile_balls_capacity = bins->tile_start[KERNEL_NUM_TILES] * 2;
+        free(bins->tile_balls);
+        bins->tile_balls = MALLOC((size_t)bins->tile_balls_capacity * sizeof(int));
+    }
+
+    memcpy(bins->tile_fill, bins->tile_start, (size_t)KERNEL_NUM_TILES * sizeof(int));
+
+    for (int k = 0; k < shown->count; k++)
+    {
+        Rect box;
+        if (KERNEL(ball_box)(shown, k, &box))
+            FOR_EACH_TILE_IN(box, KERNEL_TILE_COLS, t)
+                bins->tile_balls[bins->tile_fill[t]++] = k;
+    }
+}
+
+// the boxes a ball that moved has to be redrawn in: its old and new box, or one box around both when they overlap.
+// was_shown when it was drawn into canvas last time, is_shown when it is centred on (cx, cy) now.
+static inline int KERNEL(moved_boxes)(const Canvas *canvas, const int i, const bool was_shown, const bool is_shown,
+                                      const int cx, const int cy, Rect boxes[2])
+{
+    Rect old_box, new_box;
+    const bool was_on = was_shown && KERNEL(centre_box)(canvas->drawn_x[i], canvas->drawn_y[i], KERNEL_RADIUS_OF(i), &old_box);
+    const bool is_on = is_shown && KERNEL(centre_box)(cx, cy, KERNEL_RADIUS_OF(i), &new_box);
+    int count = 0;
+
+    if (was_on && is_on && old_box.x0 < new_box.x1 && new_box.x0 < old_box.x1 && old_box.y0 < new_box.y1 && new_box.y0 < old_box.y1)
+        boxes[count++] = (Rect){
+            old_box.x0 < new_box.x0 ? old_box.x0 : new_box.x0, old_box.y0 < new_box.y0 ? old_box.y0 : new_box.y0,
+            old_box.x1 > new_box.x1 ? old_box.x1 : new_box.x1, old_box.y1 > new_box.y1 ? old_box.y1 : new_box.y1};
+    else
+    {
+        if (was_on) boxes[count++] = old_box;
+        if (is_on) boxes[count++] = new_box;
+    }
+
+    // a yuv420 box has to cover whole chroma samples. the frame size is even, so this never leaves the frame.
+    if (yuv420)
+        for (int b = 0; b < count; b++)
+            boxes[b] = (Rect){boxes[b].x0 & ~1, boxes[b].y0 & ~1, (boxes[b].x1 + 1) & ~1, (boxes[b].y1 + 1) & ~1};
+
+    return count;
+}
+
+// the next ball out of the ones drawn into canvas last time and the ones shown now, both in index order, from
+// drawn_balls[*drawn] and shown ball *k on. moves both past it and returns its boxes to redraw, none when it stayed
+// put, or -1 when there are no balls left. *ball, *cx and *cy are the ball and where it is centred now.
+static inline int KERNEL(next_changed)(const Canvas *canvas, const Shown *shown, int *drawn, int *k, int *ball, int *cx, int *cy, Rect boxes[2])
+{
+    if (*drawn == canvas->num_drawn && *k == shown->count)
+        return -1;
+
+    const int old_i = *drawn < canvas->num_drawn ? canvas->drawn_balls[*drawn] : num_balls;
+    const int new_i = *k < shown->count ? shown->balls[*k] : num_balls;
+    const int i = old_i < new_i ? old_i : new_i;
+    const bool was_shown = old_i == i;
+    const bool is_shown = new_i == i;
+
+    *ball = i;
+    *cx = is_shown ? KERNEL(centre_of)(shown->x[*k], i) : 0;
+    *cy = is_shown ? KERNEL(centre_of)(shown->y[*k], i) : 0;
+    *drawn += was_shown;
+    *k += is_shown;
+
+    if (was_shown && is_shown && *cx == canvas->drawn_x[i] && *cy == canvas->drawn_y[i])
+        return 0;
+
+    return KERNEL(moved_boxes)(canvas, i, was_shown, is_shown, *cx, *cy, boxes);
+}
+
+// the boxes of every ball that moved, came into view or left it since the last frame drawn into canvas, cut up by tile.
+// the boxes of tile t are dirty_boxes[dirty_start[t] .. dirty_start[t + 1]] of the canvas's bins.
+static inline void KERNEL(bin_dirty_boxes)(Canvas *canvas, const Shown *shown)
+{
+    TileBins *bins = &canvas->bins;
+    memset(bins->dirty_start, 0, (size_t)(KERNEL_NUM_TILES + 1) * sizeof(int));
+
+    int drawn = 0, k = 0, i, cx, cy, count;
+    Rect boxes[2];
+
+    while ((count = KERNEL(next_changed)(canvas, shown, &drawn, &k, &i, &cx, &cy, boxes)) >= 0)
+        for (int b = 0; b < count; b++)
+            FOR_EACH_TILE_IN(boxes[b], KERNEL_TILE_COLS, t)
+                bins->dirty_start[t + 1]++;
+
+    for (int t = 0; t < KERNEL_NUM_TILES; t++)
+        bins->dirty_start[t + 1] += bins->dirty_start[t];
+
+    if (bins->dirty_boxes_capacity < bins->dirty_start[KERNEL_NUM_TILES])
+    {
+        bins->dirty_boxes_capacity = bins->dirty_start[KERNEL_NUM_TILES] * 2;
+        free(bins->dirty_boxes);
+        bins->dirty_boxes = MALLOC((size_t)bins->dirty_boxes_capacity * sizeof(Rect));
+    }
+
+    memcpy(bins->dirty_fill, bins->dirty_start, (size_t)KERNEL_NUM_TILES * sizeof(int));
+    drawn = k = 0;
+
+    while ((count = KERNEL(next_changed)(canvas, shown, &drawn, &k, &i, &cx, &cy, boxes)) >= 0)
+    {
+        for (int b = 0; b < count; b++)
+            FOR_EACH_TILE_IN(boxes[b], KERNEL_TILE_COLS, t)
+            {
+                const Rect tile = KERNEL(tile_rect)(t);
+                bins->dirty_boxes[bins->dirty_fill[t]++] = (Rect){
+                    boxes[b].x0 > tile.x0 ? boxes[b].x0 : tile.x0, boxes[b].y0 > tile.y0 ? boxes[b].y0 : tile.y0,
+                    boxes[b].x1 < tile.x1 ? boxes[b].x1 : tile.x1, boxes[b].y1 < tile.y1 ? boxes[b].y1 : tile.y1};
+            }
+
+        canvas->drawn_x[i] = cx;
+        canvas->drawn_y[i] = cy;
+    }
+
+    memcpy(canvas->drawn_balls, shown->balls, (size_t)shown->count * sizeof(int));
+    canvas->num_drawn = shown->count;
+}
+
+// clears rect and draws the balls of tile t that touch it, in index order. returns the bytes written.
+static inline uint64_t KERNEL(redraw_rect_rgb)(uint8_t *rgb_buffer, const TileBins *bins, const Shown *shown, const int t, const Rect rect)
+{
+    // Fill background with vscode gray: #1e1e1e (30,30,30)
+    for (int py = rect.y0; py < rect.y1; py++)
+        memset(rgb_buffer + ((size_t)py * (size_t)KERNEL_FRAME_WIDTH + (size_t)rect.x0) * 3, 30, (size_t)(rect.x1 - rect.x0) * 3);
+
+    uint64_t pixels = (uint64_t)(rect.x1 - rect.x0) * (uint64_t)(rect.y1 - rect.y0);
+
+    for (int k = bins->tile_start[t]; k < bins->tile_start[t + 1]; k++)
+        pixels += (uint64_t)KERNEL(draw_ball_rgb)(rgb_buffer, shown, bins->tile_balls[k], rect);
+
+    return pixels * 3;
+}
+
+// same as redraw_rect_rgb for planar yuv420. rect has to start and end on even pixels, so it covers whole chroma samples.
+// the chroma is drawn at full resolution first and every 2x2 block averaged, so the edges of the balls blend the way
+// they would if the rgb frame were converted.
+static inline uint64_t KERNEL(redraw_rect_yuv)(uint8_t *frame, const TileBins *bins, const Shown *shown, const int t, const Rect rect)
+{
+    uint8_t chroma_u[TILE_HEIGHT][TILE_WIDTH];
+    uint8_t chroma_v[TILE_HEIGHT][TILE_WIDTH];
+
+    const Rect tile = KERNEL(tile_rect)(t);
+    const size_t chroma_width = (size_t)KERNEL_FRAME_WIDTH / 2;
+    uint8_t *u_plane = frame + (size_t)KERNEL_FRAME_WIDTH * (size_t)KERNEL_FRAME_HEIGHT;
+    uint8_t *v_plane = u_plane + chroma_width * (size_t)(KERNEL_FRAME_HEIGHT / 2);
+    const size_t width = (size_t)(rect.x1 - rect.x0);
+
+    for (int py = rect.y0; py < rect.y1; py++)
+    {
+        memset(frame + (size_t)py * (size_t)KERNEL_FRAME_WIDTH + (size_t)rect.x0, (uint8_t)(background_yuv >> 16), width);
+        memset(&chroma_u[py - tile.y0][rect.x0 - tile.x0], (uint8_t)(background_yuv >> 8), width);
+        memset(&chroma_v[py - tile.y0][rect.x0 - tile.x0], (uint8_t)background_yuv, width);
+    }
+
+    uint64_t pixels = 0;
+
+    for (int k = bins->tile_start[t]; k < bins->tile_start[t + 1]; k++)
+        pixels += (uint64_t)KERNEL(draw_ball_yuv)(frame, chroma_u, chroma_v, tile.x0, tile.y0, shown, bins->tile_balls[k], rect);
+
+    for (int py = rect.y0; py < rect.y1; py += 2)
+    {
+        const uint8_t *u0 = &chroma_u[py - tile.y0][rect.x0 - tile.x0], *u1 = u0 + TILE_WIDTH;
+        const uint8_t *v0 = &chroma_v[py - tile.y0][rect.x0 - tile.x0], *v1 = v0 + TILE_WIDTH;
+        uint8_t *u_row = u_plane + (size_t)(py / 2) * chroma_width + (size_t)(rect.x0 / 2);
+        uint8_t *v_row = v_plane + (size_t)(py / 2) * chroma_width + (size_t)(rect.x0 / 2);
+
+        for (size_t k = 0; k < width / 2; k++)
+        {
+            u_row[k] = (uint8_t)((u0[2 * k] + u0[2 * k + 1] + u1[2 * k] + u1[2 * k + 1] + 2) >> 2);
+            v_row[k] = (uint8_t)((v0[2 * k] + v0[2 * k + 1] + v1[2 * k] + v1[2 * k + 1] + 2) >> 2);
+        }
+    }
+
+    return (uint64_t)width * (uint64_t)(rect.y1 - rect.y0) * 3 / 2 + pixels;
+}
+
+static inline uint64_t KERNEL(redraw_rect)(Canvas *canvas, const Shown *shown, const int t, const Rect rect)
+{
+    return yuv420 ? KERNEL(redraw_rect_yuv)(canvas->pixels, &canvas->bins, shown, t, rect)
+                  : KERNEL(redraw_rect_rgb)(canvas->pixels, &canvas->bins, shown, t, rect);
+}
+
+// draws the shown balls into a whole frame. returns the bytes written.
+uint64_t KERNEL(render_frame)(Canvas *canvas, const Shown *shown)
+{
+    KERNEL(bin_balls)(&canvas->bins, shown);
+
+    uint64_t bytes = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:bytes) if(KERNEL_FRAME_WIDTH * KERNEL_FRAME_HEIGHT >= PARALLEL_MIN_PIXELS)
+    for (int t = 0; t < KERNEL_NUM_TILES; t++)
+        bytes += KERNEL(redraw_rect)(canvas, shown, t, KERNEL(tile_rect)(t));
+
+    return bytes;
+}
+
+// brings canvas from the last frame drawn into it to the shown balls by redrawing only the dirty boxes.
+// every dirty box is cleared and redrawn from all the balls of its tile, so the result is the same as render_frame.
+uint64_t KERNEL(render_dirty)(Canvas *canvas, const Shown *shown)
+{
+    if (!canvas->drawn)
+    {
+        for (int k = 0; k < shown->count; k++)
+        {
+            canvas->drawn_x[shown->balls[k]] = KERNEL(centre_of)(shown->x[k], shown->balls[k]);
+            canvas->drawn_y[shown->balls[k]] = KERNEL(centre_of)(shown->y[k], shown->balls[k]);
+        }
+
+        memcpy(canvas->drawn_balls, shown->balls, (size_t)shown->count * sizeof(int));
+        canvas->num_drawn = shown->count;
+        canvas->drawn = true;
+        return KERNEL(render_frame)(canvas, shown);
+    }
+
+    KERNEL(bin_balls)(&canvas->bins, shown);
+    KERNEL(bin_dirty_boxes)(canvas, shown);
+
+    const TileBins *bins = &canvas->bins;
+    uint64_t bytes = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:bytes) if(bins->dirty_start[KERNEL_NUM_TILES] >= PARALLEL_MIN_DIRTY_BOXES)
+    for (int t = 0; t < KERNEL_NUM_TILES; t++)
+    {
+        // past a few boxes it is cheaper to redraw the whole tile once.
+        if (bins->dirty_start[t + 1] - bins->dirty_start[t] > DIRTY_BOXES_PER_TILE)
+            bytes += KERNEL(redraw_rect)(canvas, shown, t, KERNEL(tile_rect)(t));
+        else
+            for (int d = bins->dirty_start[t]; d < bins->dirty_start[t + 1]; d++)
+                bytes += KERNEL(redraw_rect)(canvas, shown, t, bins->dirty_boxes[d]);
+    }
+
+    return bytes;
+}
+
+
+
+#undef KERNEL_NUM_TILES
+#undef KERNEL_TILE_ROWS
+#undef KERNEL_TILE_COLS
+#undef KERNEL_RADIUS_OF
+#undef KERNEL_SPANS_OF
+#undef KERNEL_SIZE_OF
+#undef KERNEL_MIXED_SIZES
+#undef KERNEL
+#undef KERNEL_PASTE
+#undef KERNEL_PASTE_
+#undef KERNEL_SUFFIX
+#undef KERNEL_BALL_SIZE
+#undef KERNEL_FRAME_WIDTH
+#undef KERNEL_FRAME_HEIGHT
@@ -0,0 +1,130 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+/*
+bounded single producer / single consumer ring of slot indices.
+the slots themselves (frame buffers, ball snapshots) live with the caller and are handed
+between the two threads by index, so nothing is copied to pass a slot along.
+the consumer may hold on to several slots at once, they are released oldest first.
+*/
+
+
+
+
+// how often a stage had to wait on its neighbour, and for how long in total.
+typedef struct
+{
+    uint64_t waits;
+    double wait_ms;
+} Stalls;
+
+typedef struct
+{
+    _Atomic uint32_t head; // slots published by the producer
+    _Atomic uint32_t tail; // slots released by the consumer
+    uint32_t read;         // slots acquired by the consumer, only the consumer touches it
+    _Atomic bool done;     // the producer will not publish anything else
+    uint32_t size;
+} Ring;
+
+
+
+
+static inline double ring_ms_since(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1000.0 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+// spins for a while, then backs off to short sleeps so a stalled stage doesn't steal its neighbour's core.
+static inline void ring_back_off(uint32_t *spins)
+{
+    if ((*spins)++ < 64)
+    {
+        sched_yield();
+        return;
+    }
+
+    const struct timespec nap = {0, 50000};
+    nanosleep(&nap, NULL);
+}
+
+
+
+
+// producer: waits for a free slot and returns its index. fill it, then call ring_publish.
+static inline uint32_t ring_acquire_write(Ring *ring, Stalls *stalls)
+{
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->size)
+    {
+        struct timespec since;
+        clock_gettime(CLOCK_MONOTONIC, &since);
+
+        uint32_t spins = 0;
+        while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->size)
+            ring_back_off(&spins);
+
+        stalls->waits++;
+        stalls->wait_ms += ring_ms_since(&since);
+    }
+
+    return head % ring->size;
+}
+
+static inline void ring_publish(Ring *ring)
+{
+    atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+}
+
+// producer: no more slots will be published.
+static inline void ring_finish(Ring *ring)
+{
+    atomic_store_explicit(&ring->done, true, memory_order_release);
+}
+
+
+
+
+// consumer: waits for a published slot. false when the producer finished and the ring is drained.
+static inline bool ring_acquire_read(Ring *ring, Stalls *stalls, uint32_t *slot)
+{
+    const uint32_t read = ring->read;
+
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == read)
+    {
+        struct timespec since;
+        clock_gettime(CLOCK_MONOTONIC, &since);
+
+        uint32_t spins = 0;
+        while (atomic_load_explicit(&ring->head, memory_order_acquire) == read)
+        {
+            if (atomic_load_explicit(&ring->done, memory_order_acquire) &&
+                atomic_load_explicit(&ring->head, memory_order_acquire) == read)
+                return false;
+            ring_back_off(&spins);
+        }
+
+        stalls->waits++;
+        stalls->wait_ms += ring_ms_since(&since);
+    }
+
+    *slot = ring->read++ % ring->size;
+    return true;
+}
+
+// consumer: done with the oldest slot it acquired, the producer may reuse it.
+static inline void ring_release(Ring *ring)
+{
+    atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
+
+#endif
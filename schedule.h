@@ -0,0 +1,134 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+frames on absolute deadlines. frame n is due at start + (n - first) / fps, worked out from n every time, so rounding
+never adds up and a frame that oversleeps doesn't push the ones after it back, the next sleep is just shorter.
+the lateness histograms say how close to their deadlines things actually happened.
+*/
+
+
+
+
+#define LATENESS_BUCKETS 12
+
+// upper bounds of the histogram buckets in microseconds, the last bucket takes the rest.
+static const int64_t lateness_bucket_us[LATENESS_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2000, 4000, 8000, 16000, 33000, 66000};
+
+typedef struct
+{
+    uint64_t counts[LATENESS_BUCKETS];
+    uint64_t total;
+    double sum_ms, max_ms;
+} Lateness;
+
+typedef struct
+{
+    _Atomic int64_t start_ns; // moves when the schedule slips, the pipeline reads it from the encoding thread
+    int64_t fps;
+    uint64_t first;           // the frame due at start_ns
+    uint64_t frame;           // the next frame schedule_wait waits for
+    uint64_t missed;          // frames that were already due before we got round to waiting for them
+    Lateness woke;            // how long after its deadline the loop got going on every frame
+} Schedule;
+
+
+
+
+static inline int64_t schedule_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline void lateness_add(Lateness *lateness, const int64_t late_ns)
+{
+    int bucket = 0;
+    while (bucket < LATENESS_BUCKETS - 1 && late_ns >= lateness_bucket_us[bucket] * 1000)
+        bucket++;
+
+    const double late_ms = (double)late_ns / 1e6;
+
+    lateness->counts[bucket]++;
+    lateness->total++;
+    lateness->sum_ms += late_ms;
+    if (late_ms > lateness->max_ms)
+        lateness->max_ms = late_ms;
+}
+
+// frame first is due right away.
+static inline void schedule_start(Schedule *schedule, const int fps, const uint64_t first)
+{
+    *schedule = (Schedule){.start_ns = schedule_now_ns(), .fps = fps, .first = first, .frame = first + 1};
+}
+
+static inline int64_t schedule_period_ns(const Schedule *schedule)
+{
+    return 1000000000 / schedule->fps;
+}
+
+static inline int64_t schedule_due_ns(const Schedule *schedule, const uint64_t frame)
+{
+    return schedule->start_ns + (int64_t)((frame - schedule->first) * 1000000000 / (uint64_t)schedule->fps);
+}
+
+// true when frame is more than a whole frame past its deadline.
+static inline bool schedule_is_behind(const Schedule *schedule, const uint64_t frame)
+{
+    return schedule_now_ns() - schedule_due_ns(schedule, frame) > schedule_period_ns(schedule);
+}
+
+// sleeps until the next frame is due. a frame that is already more than a whole frame late
+// moves the schedule back when slip is set, so the frames after it aren't all late as well.
+static inline void schedule_wait(Schedule *schedule, const bool slip)
+{
+    const int64_t due = schedule_due_ns(schedule, schedule->frame);
+    const struct timespec deadline = {due / 1000000000, due % 1000000000};
+
+    int64_t now = schedule_now_ns();
+
+    if (now < due)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            ;
+        now = schedule_now_ns();
+    }
+    else
+    {
+        schedule->missed++;
+
+        if (slip && now - due > schedule_period_ns(schedule))
+            schedule->start_ns += now - due;
+    }
+
+    lateness_add(&schedule->woke, now - due);
+    schedule->frame++;
+}
+
+static inline void lateness_print(const char *name, const Lateness *lateness)
+{
+    printf("%s: %" PRIu64 " frames, mean %.3f ms, max %.3f ms late\n", name, lateness->total,
+        lateness->total ? lateness->sum_ms / (double)lateness->total : 0.0, lateness->max_ms);
+
+    for (int b = 0; b < LATENESS_BUCKETS; b++)
+    {
+        if (!lateness->counts[b])
+            continue;
+
+        if (b < LATENESS_BUCKETS - 1)
+            printf("  < %6.2f ms %10" PRIu64 "\n", (double)lateness_bucket_us[b] / 1000.0, lateness->counts[b]);
+        else
+            printf("  more       %10" PRIu64 "\n", lateness->counts[b]);
+    }
+}
+
+#endif
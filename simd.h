@@ -0,0 +1,257 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// the kernels are picked at compile time from -march. every kernel has a scalar fallback that gives the same results.
+
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 16
+#elif defined(__AVX2__)
+#define SIMD_WIDTH 8
+#else
+#define SIMD_WIDTH 8
+#endif
+
+// storage is aligned and padded so the vector loops never need a scalar tail over padding.
+#define SIMD_ALIGN 64
+#define SIMD_PAD(n) (((n) + 15) / 16 * 16)
+
+
+
+
+/*
+moves balls first..last-1 by their velocity and reflects the ones that went through a wall.
+"first" has to be a multiple of SIMD_WIDTH so the vector loads are aligned.
+returns the number of balls reflected. a caller that ignores it doesn't pay for counting them.
+*/
+static inline int integrate_span(float *restrict x, float *restrict vx, const int first, const int last,
+                                 const float size, const float limit)
+{
+    int i = first;
+    int bounces = 0;
+
+#if defined(__AVX512F__)
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 size_v = _mm512_set1_ps(size);
+    const __m512 limit_v = _mm512_set1_ps(limit);
+    const __m512i sign = _mm512_set1_epi32((int)0x80000000u);
+
+    for (; i + 16 <= last; i += 16)
+    {
+        __m512 px = _mm512_load_ps(x + i);
+        __m512 pvx = _mm512_load_ps(vx + i);
+
+        px = _mm512_add_ps(px, pvx);
+
+        const __mmask16 out = _mm512_cmp_ps_mask(px, zero, _CMP_LT_OQ) |
+                              _mm512_cmp_ps_mask(_mm512_add_ps(px, size_v), limit_v, _CMP_GT_OQ);
+
+        bounces += __builtin_popcount(out);
+        pvx = _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(pvx), out, _mm512_castps_si512(pvx), sign));
+        px = _mm512_mask_add_ps(px, out, px, pvx);
+
+        _mm512_store_ps(x + i, px);
+        _mm512_store_ps(vx + i, pvx);
+    }
+#elif defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 size_v = _mm256_set1_ps(size);
+    const __m256 limit_v = _mm256_set1_ps(limit);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 px = _mm256_load_ps(x + i);
+        __m256 pvx = _mm256_load_ps(vx + i);
+
+        px = _mm256_add_ps(px, pvx);
+
+        const __m256 out = _mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LT_OQ),
+                                        _mm256_cmp_ps(_mm256_add_ps(px, size_v), limit_v, _CMP_GT_OQ));
+
+        bounces += __builtin_popcount((unsigned int)_mm256_movemask_ps(out));
+        pvx = _mm256_blendv_ps(pvx, _mm256_xor_ps(pvx, sign), out);
+        px = _mm256_blendv_ps(px, _mm256_add_ps(px, pvx), out);
+
+        _mm256_store_ps(x + i, px);
+        _mm256_store_ps(vx + i, pvx);
+    }
+#endif
+
+    for (; i < last; i++)
+    {
+        x[i] += vx[i];
+
+        if (x[i] < 0 || x[i] + size > limit)
+        {
+            vx[i] = -vx[i];
+            x[i] += vx[i];
+            bounces++;
+        }
+    }
+
+    return bounces;
+}
+
+// integrate_span for balls of different sizes, ball i is sizes[i] wide. sizes is aligned like x.
+static inline int integrate_span_sizes(float *restrict x, float *restrict vx, const float *restrict sizes,
+                                       const int first, const int last, const float limit)
+{
+    int i = first;
+    int bounces = 0;
+
+#if defined(__AVX512F__)
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 limit_v = _mm512_set1_ps(limit);
+    const __m512i sign = _mm512_set1_epi32((int)0x80000000u);
+
+    for (; i + 16 <= last; i += 16)
+    {
+        __m512 px = _mm512_load_ps(x + i);
+        __m512 pvx = _mm512_load_ps(vx + i);
+
+        px = _mm512_add_ps(px, pvx);
+
+        const __mmask16 out = _mm512_cmp_ps_mask(px, zero, _CMP_LT_OQ) |
+                              _mm512_cmp_ps_mask(_mm512_add_ps(px, _mm512_load_ps(sizes + i)), limit_v, _CMP_GT_OQ);
+
+        bounces += __builtin_popcount(out);
+        pvx = _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(pvx), out, _mm512_castps_si512(pvx), sign));
+        px = _mm512_mask_add_ps(px, out, px, pvx);
+
+        _mm512_store_ps(x + i, px);
+        _mm512_store_ps(vx + i, pvx);
+    }
+#elif defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 limit_v = _mm256_set1_ps(limit);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 px = _mm256_load_ps(x + i);
+        __m256 pvx = _mm256_load_ps(vx + i);
+
+        px = _mm256_add_ps(px, pvx);
+
+        const __m256 out = _mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LT_OQ),
+                                        _mm256_cmp_ps(_mm256_add_ps(px, _mm256_load_ps(sizes + i)), limit_v, _CMP_GT_OQ));
+
+        bounces += __builtin_popcount((unsigned int)_mm256_movemask_ps(out));
+        pvx = _mm256_blendv_ps(pvx, _mm256_xor_ps(pvx, sign), out);
+        px = _mm256_blendv_ps(px, _mm256_add_ps(px, pvx), out);
+
+        _mm256_store_ps(x + i, px);
+        _mm256_store_ps(vx + i, pvx);
+    }
+#endif
+
+    for (; i < last; i++)
+    {
+        x[i] += vx[i];
+
+        if (x[i] < 0 || x[i] + sizes[i] > limit)
+        {
+            vx[i] = -vx[i];
+            x[i] += vx[i];
+            bounces++;
+        }
+    }
+
+    return bounces;
+}
+
+
+
+
+/*
+bit k of the result is set when the point (px, py) is closer than sqrt(limit) to (xs[k], ys[k]).
+only the first n <= SIMD_WIDTH entries are read.
+*/
+static inline uint32_t overlap_mask(const float px, const float py, const float *xs, const float *ys,
+                                    const int n, const float limit)
+{
+#if defined(__AVX512F__)
+    const __mmask16 lanes = (__mmask16)((1u << n) - 1);
+
+    const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(px), _mm512_maskz_loadu_ps(lanes, xs));
+    const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(py), _mm512_maskz_loadu_ps(lanes, ys));
+    const __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+
+    return _mm512_mask_cmp_ps_mask(lanes, d2, _mm512_set1_ps(limit), _CMP_LT_OQ);
+#elif defined(__AVX2__)
+    const __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(px), _mm256_maskload_ps(xs, lanes));
+    const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(py), _mm256_maskload_ps(ys, lanes));
+    const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(d2, _mm256_set1_ps(limit), _CMP_LT_OQ), _mm256_castsi256_ps(lanes));
+
+    return (uint32_t)_mm256_movemask_ps(hit);
+#else
+    uint32_t mask = 0;
+    for (int k = 0; k < n; k++)
+    {
+        const float dx = px - xs[k];
+        const float dy = py - ys[k];
+        mask |= (uint32_t)(dx * dx + dy * dy < limit) << k;
+    }
+    return mask;
+#endif
+}
+
+/*
+overlap_mask for circles of different sizes: bit k is set when the circle of radius pr at (px, py) overlaps the one of
+radius rs[k] at (xs[k], ys[k]), the squared distance between them being less than slack past touching.
+*/
+static inline uint32_t overlap_mask_radii(const float px, const float py, const float pr, const float *xs, const float *ys,
+                                          const float *rs, const int n, const float slack)
+{
+#if defined(__AVX512F__)
+    const __mmask16 lanes = (__mmask16)((1u << n) - 1);
+
+    const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(px), _mm512_maskz_loadu_ps(lanes, xs));
+    const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(py), _mm512_maskz_loadu_ps(lanes, ys));
+    const __m512 reach = _mm512_add_ps(_mm512_set1_ps(pr), _mm512_maskz_loadu_ps(lanes, rs));
+    const __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+    const __m512 limit = _mm512_add_ps(_mm512_mul_ps(reach, reach), _mm512_set1_ps(slack));
+
+    return _mm512_mask_cmp_ps_mask(lanes, d2, limit, _CMP_LT_OQ);
+#elif defined(__AVX2__)
+    const __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(px), _mm256_maskload_ps(xs, lanes));
+    const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(py), _mm256_maskload_ps(ys, lanes));
+    const __m256 reach = _mm256_add_ps(_mm256_set1_ps(pr), _mm256_maskload_ps(rs, lanes));
+    const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    const __m256 limit = _mm256_add_ps(_mm256_mul_ps(reach, reach), _mm256_set1_ps(slack));
+    const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(d2, limit, _CMP_LT_OQ), _mm256_castsi256_ps(lanes));
+
+    return (uint32_t)_mm256_movemask_ps(hit);
+#else
+    uint32_t mask = 0;
+    for (int k = 0; k < n; k++)
+    {
+        const float dx = px - xs[k];
+        const float dy = py - ys[k];
+        const float reach = pr + rs[k];
+        mask |= (uint32_t)(dx * dx + dy * dy < reach * reach + slack) << k;
+    }
+    return mask;
+#endif
+}
+
+// true when (px, py) overlaps any of the first n points.
+static inline bool overlaps_any(const float px, const float py, const float *xs, const float *ys,
+                                const int n, const float limit)
+{
+    for (int k = 0; k < n; k += SIMD_WIDTH)
+        if (overlap_mask(px, py, xs + k, ys + k, n - k < SIMD_WIDTH ? n - k : SIMD_WIDTH, limit))
+            return true;
+    return false;
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+what the hot loops did on every frame: event counts, and the time and hardware counters of every phase,
+written out as one csv line or json object per frame. the counts are added to from any thread. the phases are
+marked from the frame loop. the hardware counters cover the whole process while a phase runs, including
+the threads of other pipeline stages. they are opened with inherit, so threads started afterwards count too.
+main.c wraps all of this in macros that are empty unless STATS is defined.
+*/
+
+
+
+
+enum { COUNT_PAIR_TESTS, COUNT_OVERLAPS, COUNT_NEIGHBOUR_BUILDS, COUNT_EVENTS, COUNT_IMPULSES, COUNT_WALL_BOUNCES, COUNT_DRAWN_BYTES, COUNT_PIPED_BYTES, NUM_COUNTERS };
+
+static const char *const counter_names[NUM_COUNTERS] = {"pair_tests", "overlaps", "neighbour_builds", "events", "impulses", "wall_bounces", "drawn_bytes", "piped_bytes"};
+
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, NUM_PERF };
+
+static const char *const perf_names[NUM_PERF] = {"cycles", "instructions", "cache_misses"};
+static const uint64_t perf_configs[NUM_PERF] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+
+#define STATS_MAX_PHASES 8
+
+typedef struct
+{
+    _Atomic uint64_t counts[NUM_COUNTERS]; // this frame so far
+    uint64_t frame_counts[NUM_COUNTERS];   // taken out of counts for the row being written
+    uint64_t totals[NUM_COUNTERS];         // every frame before it
+
+    int num_phases;
+    const char *const *phase_names;
+    int64_t phase_ns[STATS_MAX_PHASES];
+    uint64_t phase_perf[STATS_MAX_PHASES][NUM_PERF];
+    int64_t total_ns[STATS_MAX_PHASES];
+    uint64_t total_perf[STATS_MAX_PHASES][NUM_PERF];
+
+    int perf_fds[NUM_PERF]; // -1 when the counters couldn't be opened
+    uint64_t perf_mark[NUM_PERF];
+    int64_t mark_ns;
+
+    FILE *file; // NULL when nothing is written out
+    bool json;
+    uint64_t frames;
+} Stats;
+
+
+
+
+static inline int64_t stats_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// user space only, so it works at the default perf_event_paranoid of 2.
+static inline int stats_open_perf(const uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static inline void stats_read_perf(const Stats *stats, uint64_t values[NUM_PERF])
+{
+    for (int p = 0; p < NUM_PERF; p++)
+        if (read(stats->perf_fds[p], &values[p], sizeof(values[p])) != sizeof(values[p]))
+            values[p] = 0;
+}
+
+// one column of a row: its name for the csv header, its value for a csv row, or both for json.
+static inline void stats_column(Stats *stats, const bool names, int *column, const char *name, const char *value)
+{
+    if (stats->json)
+        fprintf(stats->file, "%s\"%s\": %s", *column ? ", " : "{", name, value);
+    else
+        fprintf(stats->file, "%s%s", *column ? "," : "", names ? name : value);
+
+    (*column)++;
+}
+
+// one row of the file, or the names of its columns when names is set.
+static inline void stats_write_row(Stats *stats, const bool names, const uint64_t frame)
+{
+    const bool perf = stats->perf_fds[0] >= 0;
+    char name[64], value[32];
+    int column = 0;
+
+    snprintf(value, sizeof(value), "%" PRIu64, frame);
+    stats_column(stats, names, &column, "frame", value);
+
+    for (int c = 0; c < NUM_COUNTERS; c++)
+    {
+        snprintf(value, sizeof(value), "%" PRIu64, stats->frame_counts[c]);
+        stats_column(stats, names, &column, counter_names[c], value);
+    }
+
+    for (int phase = 0; phase < stats->num_phases; phase++)
+    {
+        snprintf(name, sizeof(name), "%s_ms", stats->phase_names[phase]);
+        snprintf(value, sizeof(value), "%.4f", (double)stats->phase_ns[phase] / 1e6);
+        stats_column(stats, names, &column, name, value);
+
+        for (int p = 0; perf && p < NUM_PERF; p++)
+        {
+            snprintf(name, sizeof(name), "%s_%s", stats->phase_names[phase], perf_names[p]);
+            snprintf(value, sizeof(value), "%" PRIu64, stats->phase_perf[phase][p]);
+            stats_column(stats, names, &column, name, value);
+        }
+    }
+
+    fputs(stats->json ? "}" : "\n", stats->file);
+}
+
+// starts writing to path, json if it ends in .json and csv otherwise. false with errno set if it can't be created.
+// the hardware counters are left out, with *perf_error set, when perf_event_open isn't allowed.
+static inline bool stats_open(Stats *stats, const char *path, const char *const *phase_names, const int num_phases, const char **perf_error)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->phase_names = phase_names;
+    stats->num_phases = num_phases < STATS_MAX_PHASES ? num_phases : STATS_MAX_PHASES;
+
+    const size_t length = strlen(path);
+    stats->json = length >= 5 && !strcmp(path + length - 5, ".json");
+
+    stats->file = fopen(path, "w");
+    if (!stats->file)
+        return false;
+
+    *perf_error = NULL;
+    for (int p = 0; p < NUM_PERF; p++)
+    {
+        stats->perf_fds[p] = stats_open_perf(perf_configs[p]);
+
+        if (stats->perf_fds[p] < 0)
+        {
+            *perf_error = strerror(errno);
+            for (int q = 0; q < p; q++)
+                close(stats->perf_fds[q]);
+            for (int q = 0; q < NUM_PERF; q++)
+                stats->perf_fds[q] = -1;
+            break;
+        }
+    }
+
+    if (stats->json)
+        fputs("[\n", stats->file);
+    else
+        stats_write_row(stats, true, 0);
+
+    return true;
+}
+
+// the frame starts now.
+static inline void stats_begin_frame(Stats *stats)
+{
+    if (stats->perf_fds[0] >= 0)
+        stats_read_perf(stats, stats->perf_mark);
+
+    stats->mark_ns = stats_now_ns();
+}
+
+// phase ran from the last mark until now.
+static inline void stats_end_phase(Stats *stats, const int phase)
+{
+    const int64_t now = stats_now_ns();
+    stats->phase_ns[phase] += now - stats->mark_ns;
+    stats->mark_ns = now;
+
+    if (stats->perf_fds[0] < 0)
+        return;
+
+    uint64_t values[NUM_PERF];
+    stats_read_perf(stats, values);
+
+    for (int p = 0; p < NUM_PERF; p++)
+    {
+        stats->phase_perf[phase][p] += values[p] - stats->perf_mark[p];
+        stats->perf_mark[p] = values[p];
+    }
+}
+
+// writes the frame out and starts the counts of the next one from zero.
+static inline void stats_end_frame(Stats *stats, const uint64_t frame)
+{
+    for (int c = 0; c < NUM_COUNTERS; c++)
+    {
+        stats->frame_counts[c] = atomic_exchange_explicit(&stats->counts[c], 0, memory_order_relaxed);
+        stats->totals[c] += stats->frame_counts[c];
+    }
+
+    if (stats->json && stats->frames)
+        fputs(",\n", stats->file);
+
+    stats_write_row(stats, false, frame);
+    stats->frames++;
+
+    for (int phase = 0; phase < stats->num_phases; phase++)
+    {
+        stats->total_ns[phase] += stats->phase_ns[phase];
+        stats->phase_ns[phase] = 0;
+
+        for (int p = 0; p < NUM_PERF; p++)
+        {
+            stats->total_perf[phase][p] += stats->phase_perf[phase][p];
+            stats->phase_perf[phase][p] = 0;
+        }
+    }
+}
+
+// finishes the file and prints the totals. false with errno set if the file couldn't be written.
+static inline bool stats_close(Stats *stats)
+{
+    if (stats->json)
+        fputs("\n]\n", stats->file);
+
+    const bool ok = !ferror(stats->file) && fclose(stats->file) == 0;
+    stats->file = NULL;
+
+    printf("Totals over %" PRIu64 " frames:\n", stats->frames);
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        printf("  %-16s %14" PRIu64 "\n", counter_names[c], stats->totals[c]);
+
+    for (int phase = 0; phase < stats->num_phases; phase++)
+    {
+        printf("  %-16s %11.1f ms", stats->phase_names[phase], (double)stats->total_ns[phase] / 1e6);
+
+        if (stats->perf_fds[0] >= 0)
+            for (int p = 0; p < NUM_PERF; p++)
+                printf("  %s %" PRIu64, perf_names[p], stats->total_perf[phase][p]);
+
+        printf("\n");
+    }
+
+    for (int p = 0; p < NUM_PERF; p++)
+        if (stats->perf_fds[p] >= 0)
+            close(stats->perf_fds[p]);
+
+    return ok;
+}
+
+#endif
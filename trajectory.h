@@ -0,0 +1,233 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+trajectory files: the state of every ball on every frame of a run, so the frames can be drawn again later,
+in any order, at another size or in other colours, without running the physics again.
+the file is a TrajectoryHeader, the ball colours and sizes, then one record per frame of x, y, vx and vy arrays,
+16 bytes a ball. the whole file is reserved on disk up front and mapped, so writing a frame is four memcpys
+and a full disk shows up when the file is created instead of as a SIGBUS half way through.
+*/
+
+
+
+
+#define TRAJECTORY_MAGIC "BALLTRAJ"
+#define TRAJECTORY_VERSION 2
+#define TRAJECTORY_ALIGN 64
+
+enum { TRAJECTORY_X, TRAJECTORY_Y, TRAJECTORY_VX, TRAJECTORY_VY, TRAJECTORY_ARRAYS };
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+
+    uint64_t first_frame; // number of the first frame in the file
+    uint64_t frames;      // frames written, bumped after every whole frame
+    uint64_t capacity;    // frames the file has room for, the same as frames once it is closed
+
+    int32_t frame_width, frame_height; // what the run was drawn at, the world is what the positions are in
+    int32_t world_width, world_height;
+    int32_t num_balls, ball_size, fps, seed; // ball_size is the smallest of the sizes
+
+    uint64_t color;       // file offset of the colours, num_balls entries
+    uint64_t size;        // file offset of the ball sizes, num_balls entries
+    uint64_t first;       // file offset of the first frame
+    uint64_t array_bytes; // distance between the arrays of a frame
+    uint64_t frame_bytes; // distance between frames
+} TrajectoryHeader;
+
+typedef struct
+{
+    TrajectoryHeader *header; // the mapped file, NULL when none is open
+    size_t mapped_bytes;
+    int fd;
+} TrajectoryWriter;
+
+
+
+
+static inline uint64_t trajectory_align(const uint64_t offset)
+{
+    return (offset + TRAJECTORY_ALIGN - 1) / TRAJECTORY_ALIGN * TRAJECTORY_ALIGN;
+}
+
+// fills in everything about the layout of a trajectory of num_balls balls with room for capacity frames.
+static inline void trajectory_layout(TrajectoryHeader *header, const int num_balls, const uint64_t capacity)
+{
+    const uint64_t array_bytes = trajectory_align((uint64_t)num_balls * 4);
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic));
+    header->version = TRAJECTORY_VERSION;
+    header->header_bytes = sizeof(TrajectoryHeader);
+    header->num_balls = num_balls;
+    header->capacity = capacity;
+
+    header->color = trajectory_align(sizeof(TrajectoryHeader));
+    header->size = header->color + array_bytes;
+    header->first = header->size + array_bytes;
+    header->array_bytes = array_bytes;
+    header->frame_bytes = TRAJECTORY_ARRAYS * array_bytes;
+}
+
+static inline uint64_t trajectory_file_bytes(const TrajectoryHeader *header, const uint64_t frames)
+{
+    return header->first + frames * header->frame_bytes;
+}
+
+// array (TRAJECTORY_X ..) of frame k of the file, counting from its first frame.
+static inline const float *trajectory_array(const TrajectoryHeader *header, const uint64_t k, const int array)
+{
+    const uint8_t *bytes = (const uint8_t *)header;
+    return (const float *)(const void *)(bytes + header->first + k * header->frame_bytes + (uint64_t)array * header->array_bytes);
+}
+
+static inline const uint32_t *trajectory_colors(const TrajectoryHeader *header)
+{
+    return (const uint32_t *)(const void *)((const uint8_t *)header + header->color);
+}
+
+static inline const float *trajectory_sizes(const TrajectoryHeader *header)
+{
+    return (const float *)(const void *)((const uint8_t *)header + header->size);
+}
+
+// creates path laid out like layout, with the colours and sizes filled in. false with errno set if it couldn't.
+static inline bool trajectory_create(TrajectoryWriter *writer, const char *path, const TrajectoryHeader *layout,
+                                     const uint32_t *colors, const float *sizes)
+{
+    const uint64_t file_bytes = trajectory_file_bytes(layout, layout->capacity);
+
+    writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0)
+        return false;
+
+    // posix_fallocate returns the error instead of setting errno.
+    const int error = posix_fallocate(writer->fd, 0, (off_t)file_bytes);
+    if (error)
+    {
+        close(writer->fd);
+        errno = error;
+        return false;
+    }
+
+    void *mapped = mmap(NULL, (size_t)file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(writer->fd);
+        return false;
+    }
+
+    // written once and never read back while recording.
+    madvise(mapped, (size_t)file_bytes, MADV_SEQUENTIAL);
+
+    writer->header = mapped;
+    writer->mapped_bytes = (size_t)file_bytes;
+    *writer->header = *layout;
+    memcpy((uint8_t *)mapped + layout->color, colors, (size_t)layout->num_balls * sizeof(uint32_t));
+    memcpy((uint8_t *)mapped + layout->size, sizes, (size_t)layout->num_balls * sizeof(float));
+
+    return true;
+}
+
+// adds the next frame. false when the file is full.
+static inline bool trajectory_append(TrajectoryWriter *writer, const float *x, const float *y, const float *vx, const float *vy)
+{
+    TrajectoryHeader *header = writer->header;
+    if (header->frames == header->capacity)
+        return false;
+
+    const float *arrays[TRAJECTORY_ARRAYS] = {x, y, vx, vy};
+    const size_t bytes = (size_t)header->num_balls * sizeof(float);
+
+    for (int a = 0; a < TRAJECTORY_ARRAYS; a++)
+        memcpy((void *)(uintptr_t)trajectory_array(header, header->frames, a), arrays[a], bytes);
+
+    header->frames++;
+    return true;
+}
+
+// cuts the file down to the frames written and closes it. false with errno set if that failed.
+static inline bool trajectory_close(TrajectoryWriter *writer)
+{
+    TrajectoryHeader *header = writer->header;
+
+    header->capacity = header->frames;
+    const uint64_t file_bytes = trajectory_file_bytes(header, header->frames);
+
+    bool ok = munmap(header, writer->mapped_bytes) == 0;
+    ok = ok && ftruncate(writer->fd, (off_t)file_bytes) == 0;
+    ok = close(writer->fd) == 0 && ok;
+
+    writer->header = NULL;
+    return ok;
+}
+
+// maps a trajectory file and checks it. NULL with *error set if it isn't a whole trajectory of this version.
+// a file that was still being written, or was left behind by a crash, is good up to the frames it says it has.
+static inline const TrajectoryHeader *trajectory_map(const char *path, const char **error)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(TrajectoryHeader))
+    {
+        close(fd);
+        *error = "too short for a trajectory";
+        return NULL;
+    }
+
+    void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED)
+    {
+        *error = strerror(errno);
+        return NULL;
+    }
+
+    const TrajectoryHeader *header = mapped;
+    TrajectoryHeader expected;
+    trajectory_layout(&expected, header->num_balls, header->capacity);
+
+    if (memcmp(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic)) != 0)
+        *error = "not a trajectory";
+    else if (header->version != TRAJECTORY_VERSION || header->header_bytes != sizeof(TrajectoryHeader))
+        *error = "trajectory from a different version";
+    else if (header->num_balls < 1 || header->ball_size < 2 || header->fps < 1 || header->world_width < 1 || header->world_height < 1 ||
+             header->color != expected.color || header->size != expected.size || header->first != expected.first ||
+             header->array_bytes != expected.array_bytes || header->frame_bytes != expected.frame_bytes ||
+             header->frames > header->capacity || trajectory_file_bytes(header, header->capacity) != (uint64_t)info.st_size)
+        *error = "trajectory is truncated or damaged";
+    else if (!header->frames)
+        *error = "trajectory has no frames";
+    else
+        return header;
+
+    munmap(mapped, (size_t)info.st_size);
+    return NULL;
+}
+
+static inline void trajectory_unmap(const TrajectoryHeader *header)
+{
+    munmap((void *)(uintptr_t)header, trajectory_file_bytes(header, header->capacity));
+}
+
+#endif